@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Check that cached results of the dataflow passes print like a solve.
+
+A synthetic module from `GenerateIR.py` is analyzed by each pass in each
+solver mode three times: without a cache, with an empty cache (all misses)
+and again with the filled cache (all hits). Apart from the `Cache:` lines,
+all three must print the same bytes.
+
+Usage: CheckCache.py --plugins BUILD_DIR [--opt OPT]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import GenerateIR  # noqa: E402
+
+# Small enough to keep the test fast, with pointers for `maypointto`
+MODULE = dict(functions=4, blocks=40, depth=2, phis=2, pointers=4)
+
+# Pass name, plugin library and solver modes
+ANALYSES = [
+    ("reaching", "ReachingDefinition", ["", "block", "sparse"]),
+    ("liveness", "LiveVariable", ["", "block", "sparse"]),
+    ("maypointto", "MayPointToAnalysis", ["", "block"]),
+]
+
+
+def run_opt(command):
+    """Run `command`, return its stderr split into (facts, cache lines)"""
+    process = subprocess.run(command, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE, text=True)
+    if process.returncode != 0:
+        sys.exit(f"{' '.join(command)} failed:\n{process.stderr}")
+    lines = process.stderr.splitlines(keepends=True)
+    facts = "".join(line for line in lines if not line.startswith("Cache:"))
+    cache = [line.strip() for line in lines if line.startswith("Cache:")]
+    return facts, cache
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare cache hits of the dataflow passes with solves")
+    parser.add_argument("--plugins", required=True,
+                        help="directory containing the built pass plugins")
+    parser.add_argument("--opt", default="opt")
+    args = parser.parse_args()
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as temp:
+        module = os.path.join(temp, "module.ll")
+        with open(module, "w") as file:
+            file.write(GenerateIR.generate(**MODULE))
+
+        for analysis, library, modes in ANALYSES:
+            plugin = os.path.join(args.plugins, f"lib{library}.so")
+            for mode in modes:
+                cache = os.path.join(temp, f"{analysis}-{mode or 'instr'}")
+
+                def run(*params):
+                    params = ";".join(filter(None, [mode, *params]))
+                    return run_opt([args.opt, "-load-pass-plugin", plugin,
+                                    f"-passes={analysis}<{params}>", module,
+                                    "-disable-output"])
+
+                solved, _ = run()
+                missed, misses = run(f"cache={cache}")
+                hit, hits = run(f"cache={cache}")
+
+                name = f"{analysis}<{mode}>" if mode else analysis
+                if missed != solved:
+                    print(f"{name}: cache miss differs from a solve")
+                    failures += 1
+                if hit != solved:
+                    print(f"{name}: cache hit differs from a solve")
+                    failures += 1
+                if f"Cache: 0 hits, {MODULE['functions']} misses" not in misses:
+                    print(f"{name}: empty cache did not miss: {misses[-1:]}")
+                    failures += 1
+                if f"Cache: {MODULE['functions']} hits, 0 misses" not in hits:
+                    print(f"{name}: filled cache did not hit: {hits[-1:]}")
+                    failures += 1
+
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+"""Generate a synthetic LLVM IR module for benchmarking the dataflow passes.
+
+Functions are structured programs: sequences of straight-line code, if-else
+diamonds and counted loops nested up to a given depth, so that every
+generated module is valid SSA. Knobs:
+
+  --functions  number of functions in the module
+  --blocks     approximate number of basic blocks per function
+  --depth      maximum loop nesting depth
+  --phis       phis per merge block / loop header, besides loop counters
+  --pointers   number of `i32` slots and `i32*` slots allocated per function,
+               accessed by loads and stores to exercise `maypointto`
+  --seed       random seed, the same arguments always give the same module
+
+Usage: GenerateIR.py [options] > module.ll
+"""
+
+import argparse
+import random
+import sys
+
+# Limit on nested if-else diamonds and loops, beyond which regions are
+# straight-line code
+MAX_NESTING = 8
+
+
+class FunctionGenerator:
+    def __init__(self, rng, name, blocks, depth, phis, pointers):
+        self.rng = rng
+        self.name = name
+        self.blocks = blocks
+        self.depth = depth
+        self.phis = phis
+        self.pointers = pointers
+        self.lines = []
+        self.next_value = 0
+        self.next_block = 0
+        self.num_blocks = 0
+        # Label of the block currently being filled
+        self.block = None
+
+    def value(self):
+        self.next_value += 1
+        return f"%v{self.next_value}"
+
+    def label(self, kind):
+        self.next_block += 1
+        return f"{kind}{self.next_block}"
+
+    def start_block(self, label):
+        self.lines.append(f"{label}:")
+        self.block = label
+        self.num_blocks += 1
+
+    def emit(self, instr):
+        self.lines.append(f"  {instr}")
+
+    def straight_line(self, values):
+        """A few arithmetic instructions, loads and stores"""
+        for _ in range(self.rng.randint(2, 6)):
+            kind = self.rng.random()
+            if kind < 0.5 or self.pointers == 0:
+                op = self.rng.choice(["add", "sub", "mul", "xor", "and"])
+                lhs, rhs = self.rng.choice(values), self.rng.choice(values)
+                result = self.value()
+                self.emit(f"{result} = {op} i32 {lhs}, {rhs}")
+                values.append(result)
+            elif kind < 0.65:
+                slot = self.rng.randrange(self.pointers)
+                value = self.rng.choice(values)
+                self.emit(f"store i32 {value}, i32* %p{slot}")
+            elif kind < 0.8:
+                slot = self.rng.randrange(self.pointers)
+                result = self.value()
+                self.emit(f"{result} = load i32, i32* %p{slot}")
+                values.append(result)
+            elif kind < 0.9:
+                slot = self.rng.randrange(self.pointers)
+                target = self.rng.randrange(self.pointers)
+                self.emit(f"store i32* %p{target}, i32** %pp{slot}")
+            else:
+                # Load through a pointer loaded from a slot
+                slot = self.rng.randrange(self.pointers)
+                pointer, result = self.value(), self.value()
+                self.emit(f"{pointer} = load i32*, i32** %pp{slot}")
+                self.emit(f"{result} = load i32, i32* {pointer}")
+                values.append(result)
+
+    def branch(self, values, depth, nesting):
+        cond = self.value()
+        self.emit(f"{cond} = icmp slt i32 {self.rng.choice(values)}, "
+                  f"{self.rng.choice(values)}")
+        then, other, merge = (self.label("then"), self.label("else"),
+                              self.label("merge"))
+        self.emit(f"br i1 {cond}, label %{then}, label %{other}")
+
+        # Each arm ends in some block, which is what the phis refer to
+        arms = []
+        for arm in [then, other]:
+            self.start_block(arm)
+            arm_values = list(values)
+            self.region(arm_values, depth, nesting + 1)
+            self.emit(f"br label %{merge}")
+            arms.append((self.block, arm_values))
+
+        self.start_block(merge)
+        for _ in range(self.phis):
+            result = self.value()
+            incoming = ", ".join(
+                f"[ {self.rng.choice(arm_values)}, %{block} ]"
+                for block, arm_values in arms)
+            self.emit(f"{result} = phi i32 {incoming}")
+            values.append(result)
+
+    def loop(self, values, depth, nesting):
+        preheader = self.block
+        header, body, exit = (self.label("header"), self.label("body"),
+                              self.label("exit"))
+        self.emit(f"br label %{header}")
+
+        # Phis refer to values of the latch, which are only known once the
+        # body is generated
+        self.start_block(header)
+        counter = self.value()
+        counter_line = len(self.lines)
+        self.emit("")
+        carried = []
+        for _ in range(self.phis):
+            carried.append((self.value(), self.rng.choice(values),
+                            len(self.lines)))
+            self.emit("")
+        cond = self.value()
+        self.emit(f"{cond} = icmp slt i32 {counter}, %n")
+        self.emit(f"br i1 {cond}, label %{body}, label %{exit}")
+
+        self.start_block(body)
+        body_values = values + [counter] + [phi for phi, _, _ in carried]
+        self.region(body_values, depth + 1, nesting + 1)
+        next = self.value()
+        self.emit(f"{next} = add i32 {counter}, 1")
+        self.emit(f"br label %{header}")
+        latch = self.block
+
+        self.lines[counter_line] = (
+            f"  {counter} = phi i32 [ 0, %{preheader} ], [ {next}, %{latch} ]")
+        for phi, initial, line in carried:
+            latch_value = self.rng.choice(body_values)
+            self.lines[line] = (
+                f"  {phi} = phi i32 [ {initial}, %{preheader} ], "
+                f"[ {latch_value}, %{latch} ]")
+
+        # The header dominates the exit, its phis are available after the
+        # loop
+        self.start_block(exit)
+        values.append(counter)
+        values.extend(phi for phi, _, _ in carried)
+
+    def region(self, values, depth, nesting):
+        """Sequence of statements, until the block budget is used up.
+        `depth` counts enclosing loops, `nesting` all enclosing statements."""
+        self.straight_line(values)
+        while self.num_blocks < self.blocks:
+            kind = self.rng.random()
+            if depth < self.depth and kind < 0.35:
+                self.loop(values, depth, nesting)
+            elif kind < 0.7 and nesting < MAX_NESTING:
+                self.branch(values, depth, nesting)
+            else:
+                self.straight_line(values)
+            # Nested regions stop early, so that blocks are spread over the
+            # whole function
+            if nesting > 0 and self.rng.random() < 0.5:
+                break
+
+    def generate(self):
+        self.lines.append(f"define i32 @{self.name}(i32 %n, i32 %a) {{")
+        self.start_block("entry")
+        for slot in range(self.pointers):
+            self.emit(f"%p{slot} = alloca i32")
+            self.emit(f"%pp{slot} = alloca i32*")
+            self.emit(f"store i32* %p{slot}, i32** %pp{slot}")
+        values = ["%n", "%a"]
+        while self.num_blocks < self.blocks:
+            self.region(values, 0, 0)
+        self.emit(f"ret i32 {values[-1]}")
+        self.lines.append("}")
+        return "\n".join(self.lines)
+
+
+def generate(functions=1, blocks=100, depth=2, phis=2, pointers=8, seed=0):
+    """Return the text of the module"""
+    rng = random.Random(seed)
+    return "\n\n".join(
+        FunctionGenerator(rng, f"f{i}", blocks, depth, phis,
+                          pointers).generate()
+        for i in range(functions)) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generate a synthetic LLVM IR module")
+    parser.add_argument("--functions", type=int, default=1)
+    parser.add_argument("--blocks", type=int, default=100)
+    parser.add_argument("--depth", type=int, default=2)
+    parser.add_argument("--phis", type=int, default=2)
+    parser.add_argument("--pointers", type=int, default=8)
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+    sys.stdout.write(generate(args.functions, args.blocks, args.depth,
+                              args.phis, args.pointers, args.seed))
+
+
+if __name__ == "__main__":
+    main()
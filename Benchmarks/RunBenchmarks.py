@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Benchmark `reaching`, `liveness` and `maypointto` on synthetic modules.
+
+Every configuration below is generated with `GenerateIR.py` and analyzed by
+each pass in each solver mode, with `stats;quiet` so that printing the facts
+does not dominate. One JSON object is printed per run, e.g.
+
+  {"config": "medium", "analysis": "reaching", "mode": "block",
+   "functions": 8, "blocks": 400, ..., "wall_seconds": 0.41,
+   "peak_rss_kib": 81234, "analyzed_functions": 8, "iterations": 5120,
+   "meets": 6144, "transfers": 40960, ..., "max_lattice_size": 312,
+   "solve_seconds": 0.32, ...}
+
+Solver stats are summed over the functions of the module, except for
+`max_lattice_size`.
+
+`--output FILE` also appends the lines to FILE, to track them over time.
+
+Usage: RunBenchmarks.py --plugins BUILD_DIR [--opt OPT] [--output FILE]
+                        [--config NAME ...] [--repeat N]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import GenerateIR  # noqa: E402
+
+# Generator arguments of each configuration. `maypointto` is by far the
+# slowest, its run time grows quickly with the number of pointers.
+CONFIGS = {
+    "small": dict(functions=32, blocks=50, depth=2, phis=2, pointers=4),
+    "medium": dict(functions=8, blocks=400, depth=3, phis=4, pointers=8),
+    "large": dict(functions=2, blocks=2000, depth=4, phis=4, pointers=8),
+    "deep": dict(functions=4, blocks=400, depth=8, phis=8, pointers=4),
+}
+
+# Pass name, plugin library and solver modes
+ANALYSES = [
+    ("reaching", "ReachingDefinition", ["", "block", "sparse"]),
+    ("liveness", "LiveVariable", ["", "block", "sparse"]),
+    ("maypointto", "MayPointToAnalysis", ["", "block"]),
+]
+
+# Solver stats printed by the passes as one JSON object per function, summed
+# over the module, or their maximum
+STATS = ["iterations", "meets", "transfers", "replays", "changes",
+         "init_seconds", "solve_seconds", "expand_seconds"]
+MAX_STATS = ["max_lattice_size"]
+
+
+def solver_stats(output):
+    """Combine the stats of all functions in the output of a pass"""
+    functions = [json.loads(line) for line in output.splitlines()
+                 if line.startswith('{"function":')]
+    result = {"analyzed_functions": len(functions)}
+    for name in STATS:
+        result[name] = sum(function[name] for function in functions)
+    for name in MAX_STATS:
+        result[name] = max((function[name] for function in functions),
+                           default=0)
+    return result
+
+
+def run_opt(command):
+    """Run `command`, return (wall seconds, peak RSS in KiB, stderr)"""
+    with tempfile.TemporaryFile() as stderr:
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdout=subprocess.DEVNULL,
+                                   stderr=stderr)
+        # Resource usage of this child alone, unlike RUSAGE_CHILDREN
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+        stderr.seek(0)
+        output = stderr.read().decode()
+    if process.returncode != 0:
+        sys.exit(f"{' '.join(command)} failed:\n{output}")
+    return wall, usage.ru_maxrss, output
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark the dataflow passes on synthetic modules")
+    parser.add_argument("--plugins", required=True,
+                        help="directory containing the built pass plugins")
+    parser.add_argument("--opt", default="opt")
+    parser.add_argument("--output", help="file to append the results to")
+    parser.add_argument("--config", action="append", choices=CONFIGS,
+                        help="configuration to run, default all")
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="runs per measurement, the fastest is reported")
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory() as temp:
+        for config in args.config or CONFIGS:
+            module = os.path.join(temp, f"{config}.ll")
+            with open(module, "w") as file:
+                file.write(GenerateIR.generate(**CONFIGS[config]))
+
+            for analysis, library, modes in ANALYSES:
+                plugin = os.path.join(args.plugins, f"lib{library}.so")
+                for mode in modes:
+                    params = ";".join(filter(None, [mode, "stats", "quiet"]))
+                    command = [args.opt, "-load-pass-plugin", plugin,
+                               f"-passes={analysis}<{params}>", module,
+                               "-disable-output"]
+                    runs = [run_opt(command) for _ in range(args.repeat)]
+                    wall = min(run[0] for run in runs)
+                    rss = min(run[1] for run in runs)
+
+                    result = {"config": config, "analysis": analysis,
+                              "mode": mode or "instruction"}
+                    result.update(CONFIGS[config])
+                    result.update(wall_seconds=round(wall, 4),
+                                  peak_rss_kib=rss)
+                    result.update(solver_stats(runs[0][2]))
+                    print(json.dumps(result), flush=True)
+                    results.append(result)
+
+    if args.output:
+        with open(args.output, "a") as file:
+            for result in results:
+                file.write(json.dumps(result) + "\n")
+
+
+if __name__ == "__main__":
+    main()
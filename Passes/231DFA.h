@@ -15,12 +15,14 @@
 #ifndef LLVM_TRANSFORMS_231DFA_H
 #define LLVM_TRANSFORMS_231DFA_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <deque>
 #include <map>
 #include <utility>
@@ -35,7 +37,8 @@ namespace llvm {
 class Info {
 public:
   Info() {}
-  Info(const Info &other) {}
+  Info(const Info &other) = default;
+  Info &operator=(const Info &other) = default;
   virtual ~Info(){};
 
   /*
@@ -76,8 +79,16 @@ private:
   std::map<unsigned, Instruction *> IndexToInstr;
   // Instruction to index map
   std::map<Instruction *, unsigned> InstrToIndex;
-  // Edge to information map
-  std::map<Edge, Info *> EdgeToInfo;
+  // Edges in the order they were added, and the information of each edge.
+  // An edge is identified by its position in these arrays.
+  std::vector<Edge> Edges;
+  std::vector<Info> EdgeInfos;
+  // Edge to position map, only used when adding edges
+  DenseMap<Edge, unsigned> EdgeToId;
+  // Positions of the incoming and outgoing edges of each instruction index,
+  // sorted by source and destination index respectively
+  std::vector<std::vector<unsigned>> IncomingEdgeIds;
+  std::vector<std::vector<unsigned>> OutgoingEdgeIds;
   // The bottom of the lattice
   Info Bottom;
   // The initial state of the analysis
@@ -124,9 +135,9 @@ private:
   void getIncomingEdges(unsigned index, std::vector<unsigned> *IncomingEdges) {
     assert(IncomingEdges->size() == 0 && "IncomingEdges should be empty.");
 
-    for (auto const &it : EdgeToInfo) {
-      if (it.first.second == index)
-        IncomingEdges->push_back(it.first.first);
+    if (index < IncomingEdgeIds.size()) {
+      for (unsigned id : IncomingEdgeIds[index])
+        IncomingEdges->push_back(Edges[id].first);
     }
 
     return;
@@ -141,9 +152,9 @@ private:
   void getOutgoingEdges(unsigned index, std::vector<unsigned> *OutgoingEdges) {
     assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
 
-    for (auto const &it : EdgeToInfo) {
-      if (it.first.first == index)
-        OutgoingEdges->push_back(it.first.second);
+    if (index < OutgoingEdgeIds.size()) {
+      for (unsigned id : OutgoingEdgeIds[index])
+        OutgoingEdges->push_back(Edges[id].second);
     }
 
     return;
@@ -151,18 +162,47 @@ private:
 
   /*
    * Utility function:
-   *   Insert an edge to EdgeToInfo.
+   *   Insert `id` into a list of edge positions, keeping it sorted by the
+   *   index of the node at the other end of the edge (`Other` selects the
+   *   end). The lists of a node are short, a linear insertion is fine.
+   */
+  template <unsigned Edge::*Other>
+  void insertSorted(std::vector<unsigned> &ids, unsigned id) {
+    auto pos = std::upper_bound(ids.begin(), ids.end(), id,
+                                [this](unsigned a, unsigned b) {
+                                  return Edges[a].*Other < Edges[b].*Other;
+                                });
+    ids.insert(pos, id);
+  }
+
+  /*
+   * Utility function:
+   *   Insert an edge with a copy of `content` as its information, and record
+   *   it in the edge lists of its source and destination.
    *   The default initial value for each edge is bottom.
    */
   void addEdge(Instruction *src, Instruction *dst, Info *content) {
     Edge edge = std::make_pair(InstrToIndex[src], InstrToIndex[dst]);
-    if (EdgeToInfo.count(edge) == 0)
-      EdgeToInfo[edge] = content;
+    auto inserted = EdgeToId.insert({edge, (unsigned)Edges.size()});
+    if (!inserted.second)
+      return;
+
+    unsigned id = Edges.size();
+    Edges.push_back(edge);
+    EdgeInfos.push_back(*content);
+
+    unsigned maxIndex = std::max(edge.first, edge.second);
+    if (OutgoingEdgeIds.size() <= maxIndex) {
+      OutgoingEdgeIds.resize(maxIndex + 1);
+      IncomingEdgeIds.resize(maxIndex + 1);
+    }
+    insertSorted<&Edge::second>(OutgoingEdgeIds[edge.first], id);
+    insertSorted<&Edge::first>(IncomingEdgeIds[edge.second], id);
     return;
   }
 
   /*
-   * Initialize EdgeToInfo and EntryInstr for a forward analysis.
+   * Initialize the edges and EntryInstr for a forward analysis.
    */
   void initializeForwardMap(Function *func) {
     assignIndiceToInstrs(func);
@@ -214,19 +254,77 @@ private:
   }
 
   /*
-   * Direction:
-   *   Implement the following function in part 3 for backward analyses
+   * Initialize the edges and EntryInstr for a backward analysis.
+   * Every edge of the forward analysis is reversed, and the dummy node has
+   * an edge to the terminator of every block without successors.
    */
-  void initializeBackwardMap(Function *func) {}
+  void initializeBackwardMap(Function *func) {
+    assignIndiceToInstrs(func);
+
+    for (Function::iterator bi = func->begin(), e = func->end(); bi != e;
+         ++bi) {
+      BasicBlock *block = &*bi;
+
+      Instruction *firstInstr = &(block->front());
+
+      // Initialize edges from the basic block to its predecessors
+      for (auto pi = pred_begin(block), pe = pred_end(block); pi != pe; ++pi) {
+        BasicBlock *prev = *pi;
+        Instruction *src = firstInstr;
+        Instruction *dst = (Instruction *)prev->getTerminator();
+        addEdge(src, dst, &Bottom);
+      }
+
+      // If there is at least one phi node, add an edge from the first non-phi
+      // node instruction to the first phi node in the basic block.
+      if (isa<PHINode>(firstInstr)) {
+        addEdge(block->getFirstNonPHI(), firstInstr, &Bottom);
+      }
+
+      // Initialize edges within the basic block
+      for (auto ii = block->begin(), ie = block->end(); ii != ie; ++ii) {
+        Instruction *instr = &*ii;
+        if (isa<PHINode>(instr))
+          continue;
+        if (instr == (Instruction *)block->getTerminator())
+          break;
+        Instruction *next = instr->getNextNode();
+        addEdge(next, instr, &Bottom);
+      }
+
+      // Initialize edges from the successors of the basic block
+      Instruction *term = (Instruction *)block->getTerminator();
+      for (auto si = succ_begin(block), se = succ_end(block); si != se; ++si) {
+        BasicBlock *succ = *si;
+        Instruction *next = &(succ->front());
+        addEdge(next, term, &Bottom);
+      }
+
+      // The analysis starts at every exit of the function
+      if (succ_begin(block) == succ_end(block)) {
+        EntryInstr = term;
+        addEdge(nullptr, term, &InitialState);
+      }
+    }
+
+    return;
+  }
 
   /*
    * The flow function.
    *   Instruction I: the IR instruction to be processed.
    *   std::vector<unsigned> & IncomingEdges: the vector of the indices of the
-   * source instructions of the incoming edges. std::vector<unsigned> &
-   * IncomingEdges: the vector of indices of the source instructions of the
-   * outgoing edges. std::vector<Info *> & Infos: the vector of the newly
-   * computed information for each outgoing eages.
+   * source instructions of the incoming edges.
+   *   std::vector<unsigned> & OutgoingEdges: the vector of the indices of the
+   * destination instructions of the outgoing edges.
+   *   std::vector<Info *> & Infos: the vector of the newly computed
+   * information for each outgoing edge.
+   *
+   * Ownership:
+   *   Infos is empty when called. Push exactly one Info allocated with `new`
+   * per outgoing edge, in the order of OutgoingEdges. The engine joins them
+   * into the edges and `delete`s them. The information on the incoming edges
+   * is read with getEdgeInfo, and stays owned by the engine.
    *
    * Direction:
    * 	 Implement this function in subclasses.
@@ -236,6 +334,20 @@ private:
                             std::vector<unsigned> &OutgoingEdges,
                             std::vector<Info *> &Infos) = 0;
 
+protected:
+  /*
+   * Utility functions for flow functions:
+   *   Information of the edge from index `src` to index `dst`, which must
+   * exist, and the index of an instruction.
+   */
+  Info *getEdgeInfo(unsigned src, unsigned dst) {
+    auto it = EdgeToId.find(std::make_pair(src, dst));
+    assert(it != EdgeToId.end() && "No such edge.");
+    return &EdgeInfos[it->second];
+  }
+
+  unsigned getIndex(Instruction *instr) { return InstrToIndex[instr]; }
+
 public:
   DataFlowAnalysis(Info &bottom, Info &initialState)
       : Bottom(bottom), InitialState(initialState), EntryInstr(nullptr) {}
@@ -250,12 +362,19 @@ public:
    * 	 The autograder will check the output of this function.
    */
   void print() {
-    for (auto const &it : EdgeToInfo) {
-      errs() << "Edge " << it.first.first
+    // Edges are printed in increasing (source, destination) order
+    std::vector<unsigned> order(Edges.size());
+    for (unsigned id = 0; id < order.size(); id++)
+      order[id] = id;
+    std::sort(order.begin(), order.end(),
+              [this](unsigned a, unsigned b) { return Edges[a] < Edges[b]; });
+
+    for (unsigned id : order) {
+      errs() << "Edge " << Edges[id].first
              << "->"
                 "Edge "
-             << it.first.second << ":";
-      (it.second)->print();
+             << Edges[id].second << ":";
+      EdgeInfos[id].print();
     }
   }
 
@@ -265,6 +384,9 @@ public:
    * (2) Initialize the worklist
    * (3) Compute until the worklist is empty
    *
+   * The engine owns the information of every edge. It hands an empty Infos
+   * to flowfunction, and deletes what it pushed once joined.
+   *
    * Direction:
    *   Implement the rest of the function.
    *   You may not change anything before "// (2) Initialize the worklist".
@@ -281,8 +403,48 @@ public:
     assert(EntryInstr != nullptr && "Entry instruction is null.");
 
     // (2) Initialize the work list
+    // Every instruction is processed at least once, in the order of the
+    // analysis. Nodes already in the work list are not added again.
+    unsigned size = IndexToInstr.size();
+    std::vector<bool> queued(size, true);
+    queued[0] = false;
+    for (unsigned i = 1; i < size; i++)
+      worklist.push_back(Direction ? i : size - i);
 
     // (3) Compute until the work list is empty
+    std::vector<unsigned> IncomingEdges, OutgoingEdges;
+    std::vector<Info *> Infos;
+    while (!worklist.empty()) {
+      unsigned index = worklist.front();
+      worklist.pop_front();
+      queued[index] = false;
+
+      IncomingEdges.clear();
+      OutgoingEdges.clear();
+      Infos.clear();
+      getIncomingEdges(index, &IncomingEdges);
+      getOutgoingEdges(index, &OutgoingEdges);
+      flowfunction(IndexToInstr[index], IncomingEdges, OutgoingEdges, Infos);
+      assert(Infos.size() == OutgoingEdges.size() &&
+             "One piece of information per outgoing edge.");
+
+      // Join the new information into each outgoing edge, and revisit the
+      // destination if the edge changed
+      for (unsigned i = 0; i < OutgoingEdges.size(); i++) {
+        unsigned dst = OutgoingEdges[i];
+        Info *old = getEdgeInfo(index, dst);
+        Info joined;
+        Info::join(Infos[i], old, &joined);
+        if (!Info::equals(&joined, old)) {
+          *old = joined;
+          if (!queued[dst]) {
+            queued[dst] = true;
+            worklist.push_back(dst);
+          }
+        }
+        delete Infos[i];
+      }
+    }
   }
 };
 
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "DFAFramework.h"
+#include "HelperFunctions.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/// Hash of a function that only depends on its structure: opcodes, types,
+/// which value each operand refers to, constants and globals by content /
+/// name, and the incoming blocks of phis. Local value names do not matter,
+/// so a function recompiled from unchanged source hashes the same. The data
+/// layout of the module is included, since facts may depend on it (e.g.
+/// field offsets of `maypointto`).
+static inline auto hashFunction(Function &F) -> std::string {
+  // Blocks and instructions are numbered up front so that forward
+  // references (phis, branches) get the same number as the definition
+  auto numbers = DenseMap<const Value *, unsigned>();
+  for (auto &BB : F) {
+    numbers.insert({&BB, numbers.size()});
+    for (auto &I : BB) {
+      numbers.insert({&I, numbers.size()});
+    }
+  }
+
+  auto text = std::string();
+  auto OS = raw_string_ostream(text);
+  OS << F.getParent()->getDataLayout().getStringRepresentation() << "\n";
+  F.getFunctionType()->print(OS);
+  for (auto &BB : F) {
+    OS << "\n" << numbers[&BB] << ":";
+    for (auto &I : BB) {
+      OS << "\n" << I.getOpcodeName() << " ";
+      I.getType()->print(OS);
+      if (auto cmp = dyn_cast<CmpInst>(&I)) {
+        OS << " " << cmp->getPredicate();
+      } else if (auto alloca = dyn_cast<AllocaInst>(&I)) {
+        OS << " ";
+        alloca->getAllocatedType()->print(OS);
+      } else if (auto gep = dyn_cast<GetElementPtrInst>(&I)) {
+        OS << " ";
+        gep->getSourceElementType()->print(OS);
+      }
+
+      for (auto &op : I.operands()) {
+        if (auto arg = dyn_cast<Argument>(op)) {
+          OS << " arg" << arg->getArgNo();
+        } else if (isa<Instruction>(op) || isa<BasicBlock>(op)) {
+          OS << " %" << numbers[op];
+        } else {
+          OS << " ";
+          op->printAsOperand(OS);
+        }
+      }
+      if (auto phi = dyn_cast<PHINode>(&I)) {
+        for (auto incoming : phi->blocks()) {
+          OS << " from %" << numbers[incoming];
+        }
+      }
+    }
+  }
+
+  auto hash = MD5();
+  hash.update(OS.str());
+  auto result = MD5::MD5Result();
+  hash.final(result);
+  return result.digest().str().str();
+}
+
+/// Persistent cache of solved analyses, one file per function named after
+/// the analysis and the structural hash of the function. A file holds the
+/// facts entering each block as written by `DataFlowAnalysis::saveFacts`,
+/// behind a small header. Files are memory mapped when read, and written to
+/// a temporary file first and renamed, so concurrent writers (parallel
+/// driver, several `opt` processes) never expose a partial entry.
+///
+/// Enabled with the `cache=DIR` pass parameter. With `validate`, every
+/// function is solved anyway and compared against its cached entry.
+class AnalysisCache {
+public:
+  AnalysisCache(StringRef dir, StringRef analysis, bool validate)
+      : dir(dir), name(analysis), validate(validate) {
+    sys::fs::create_directories(dir);
+  }
+
+  /// Print totals once the pass is destroyed, i.e. after the last function.
+  /// Passes built by `opt` only to probe pipeline names print nothing.
+  ~AnalysisCache() {
+    if (hits + misses == 0) {
+      return;
+    }
+    errs() << "Cache: " << hits << " hits, " << misses << " misses";
+    if (validate) {
+      errs() << ", " << mismatches << " mismatches";
+    }
+    errs() << "\n";
+  }
+
+  /// Load the solution of `analysis` from the cache, or solve it and store
+  /// the result. `universe` is the one the lattice values refer to. Return
+  /// what happened, to be printed along with the results.
+  template <class AnalysisT>
+  auto solve(AnalysisT &analysis, Function &F, const ValueUniverse &universe)
+      -> std::string {
+    auto path = SmallString<128>(dir);
+    sys::path::append(path, name + "-" + hashFunction(F) + ".dfa");
+
+    // Missing file and outdated / corrupt entry are both misses
+    auto cached = MemoryBuffer::getFile(path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+    if (cached && !validate) {
+      auto reader = FactReader((*cached)->getBuffer());
+      if (readHeader(reader) && analysis.loadFacts(reader, universe) &&
+          reader.atEnd()) {
+        hits += 1;
+        return "hit";
+      }
+    }
+
+    analysis.run();
+    auto writer = FactWriter();
+    writer.write(MAGIC);
+    writer.write(VERSION);
+    analysis.saveFacts(writer, universe);
+
+    auto status = std::string();
+    if (!cached) {
+      misses += 1;
+      status = "miss";
+    } else if (!validate) {
+      misses += 1;
+      status = "miss, replaced unreadable entry";
+    } else if ((*cached)->getBuffer() == writer.str()) {
+      hits += 1;
+      return "hit, validated";
+    } else {
+      hits += 1;
+      mismatches += 1;
+      status = "hit, MISMATCH, entry replaced";
+    }
+
+    if (!store(path, writer.str())) {
+      status += ", cannot write " + path.str().str();
+    }
+    return status;
+  }
+
+private:
+  /// Bump `VERSION` whenever the saved form of a lattice changes
+  static constexpr uint32_t MAGIC = 0x43414644; // "DFAC"
+  static constexpr uint32_t VERSION = 3;
+
+  static auto readHeader(FactReader &reader) -> bool {
+    uint32_t magic, version;
+    return reader.read(magic) && magic == MAGIC && reader.read(version) &&
+           version == VERSION;
+  }
+
+  static auto store(StringRef path, StringRef data) -> bool {
+    int FD;
+    auto temp = SmallString<128>();
+    if (sys::fs::createUniqueFile(path + ".%%%%%%.tmp", FD, temp)) {
+      return false;
+    }
+
+    auto OS = raw_fd_ostream(FD, /*shouldClose=*/true);
+    OS << data;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(temp);
+      return false;
+    }
+    if (sys::fs::rename(temp, path)) {
+      sys::fs::remove(temp);
+      return false;
+    }
+    return true;
+  }
+
+  std::string dir;
+  /// Name of the analysis, entries of different analyses may share `dir`
+  std::string name;
+  bool validate;
+  /// Updated concurrently by `ParallelAnalysisPass`
+  std::atomic<unsigned> hits = 0;
+  std::atomic<unsigned> misses = 0;
+  std::atomic<unsigned> mismatches = 0;
+};
+
+/// Cache selected by the `cache=DIR` and `validate` pass parameters, or null
+/// if caching is off. Copies of a pass share it, so totals are printed once.
+static inline auto makeAnalysisCache(const PassParams &params,
+                                     StringRef analysis)
+    -> std::shared_ptr<AnalysisCache> {
+  auto dir = params.find("cache");
+  if (dir == params.end()) {
+    return nullptr;
+  }
+  return std::make_shared<AnalysisCache>(
+      dir->second.empty() ? "dfa-cache" : dir->second, analysis,
+      params.count("validate"));
+}
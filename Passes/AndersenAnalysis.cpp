@@ -0,0 +1,645 @@
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "HelperFunctions.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/JSON.h"
+
+using namespace llvm;
+
+static auto PASS_NAME = "AndersenAnalysis";
+static auto PASS_VERSION = "v0.1";
+static auto ARGUMENT_NAME = "andersen";
+
+/// Set of node numbers. Points-to sets are sets of object nodes, like the
+/// location sets of `MayPointToAnalysis`.
+using NodeSet = SparseBitVector<>;
+
+/// Inclusion-based (Andersen) points-to analysis of a whole module. It is
+/// flow- and field-insensitive, but unlike `maypointto` it follows calls.
+///
+/// Every pointer value has a node holding its points-to set. So does every
+/// abstract object, i.e. allocation site (alloca, global, function, or call
+/// to an external function returning a pointer), holding what the pointers
+/// stored in it point to. Instructions become constraints between nodes:
+///
+///   p = &o      addr:  pts(p) includes o
+///   p = q       copy:  pts(p) includes pts(q), an edge q -> p
+///   p = *q      load:  pts(p) includes pts(o) for every o in pts(q)
+///   *p = q      store: pts(o) includes pts(q) for every o in pts(p)
+///
+/// `memcpy` / `memmove` load the pointers stored in the source objects and
+/// store them into the destination objects. Integers converted back to
+/// pointers may point to any object whose address was converted to an
+/// integer, or to an `unknown` object standing for memory the module does
+/// not allocate.
+///
+/// Loads and stores turn into copy edges as points-to sets grow, as do
+/// calls through function pointers, whose arguments and results are bound to
+/// the parameters and return values of every function the callee may be.
+///
+/// The worklist solver propagates only the objects that are new to a node
+/// since it was last visited (difference propagation). Nodes on a cycle of
+/// copy edges end up with the same points-to set, so they are merged into
+/// one node (union-find) when one is found. Cycles are searched lazily, when
+/// propagation along an edge leaves both ends with equal sets.
+class ConstraintGraph {
+public:
+  ConstraintGraph(Module &M) : M(M) {
+    // Addresses converted to integers escape into `escaped`, where
+    // `inttoptr` picks them up along with the unknown object, whose
+    // contents are unknown as well
+    unknown = addNode(nullptr);
+    numObjects += 1;
+    addAddr(unknown, unknown);
+    escaped = addNode(nullptr);
+    addAddr(escaped, unknown);
+
+    // Globals first, so that initializers and every function can refer to
+    // them
+    for (auto &G : M.global_objects()) {
+      valueNode(&G);
+    }
+    for (auto &G : M.globals()) {
+      if (G.hasInitializer()) {
+        addInitializer(G.getInitializer(), objectNode(&G));
+      }
+    }
+    for (auto &F : M) {
+      for (auto &arg : F.args()) {
+        valueNode(&arg);
+      }
+      if (F.getReturnType()->isPointerTy()) {
+        returnNodes[&F] = addNode(nullptr);
+      }
+    }
+    for (auto &F : M) {
+      for (auto &BB : F) {
+        for (auto &I : BB) {
+          addConstraints(I);
+        }
+      }
+    }
+  }
+
+  auto solve() -> void {
+    auto start = std::chrono::steady_clock::now();
+    auto delta = NodeSet();
+    auto next = SmallVector<unsigned, 8>();
+    auto cycleCandidates = SmallVector<unsigned, 4>();
+
+    while (!worklist.empty()) {
+      auto n = worklist.back();
+      worklist.pop_back();
+      queued[n] = false;
+      if (find(n) != n) {
+        continue;
+      }
+      iterations += 1;
+
+      // Difference propagation: only objects not yet pushed through `n`
+      delta = pts[n];
+      delta.intersectWithComplement(prev[n]);
+      if (delta.empty()) {
+        continue;
+      }
+      prev[n] = pts[n];
+
+      // Complex constraints become copy edges for every new object
+      for (auto o : delta) {
+        for (auto p : loads[n]) {
+          addCopy(o, p);
+        }
+        for (auto q : stores[n]) {
+          addCopy(q, o);
+        }
+        if (auto F = dyn_cast_or_null<Function>(values[o])) {
+          for (auto call : calls[n]) {
+            bindCall(*call, *F);
+          }
+        }
+      }
+
+      // `addCopy` above may add edges to `n` itself
+      next.clear();
+      for (auto s : succs[n]) {
+        next.push_back(s);
+      }
+      cycleCandidates.clear();
+      for (auto s : next) {
+        s = find(s);
+        if (s == n) {
+          continue;
+        }
+        if (pts[s] |= delta) {
+          push(s);
+        }
+        if (pts[s] == pts[n] && checkedEdges.insert({n, s}).second) {
+          cycleCandidates.push_back(s);
+        }
+      }
+      for (auto s : cycleCandidates) {
+        collapseCycles(s);
+      }
+    }
+
+    solveSeconds += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  }
+
+  /// Print the points-to set of every pointer value, function by function
+  auto print(raw_ostream &OS) -> void {
+    auto MST = ModuleSlotTracker(&M);
+    auto names = objectNames(MST);
+    for (auto &F : M) {
+      if (F.isDeclaration()) {
+        continue;
+      }
+      MST.incorporateFunction(F);
+      OS << "Function: " << F.getName() << "\n";
+      auto printValue = [&](Value *V) {
+        auto it = nodes.find(V);
+        if (it == nodes.end()) {
+          return;
+        }
+        V->printAsOperand(OS, /*PrintType=*/false, MST);
+        OS << ":";
+        for (auto o : pts[find(it->second)]) {
+          OS << " " << names[o];
+        }
+        OS << "\n";
+      };
+      for (auto &arg : F.args()) {
+        printValue(&arg);
+      }
+      for (auto &BB : F) {
+        for (auto &I : BB) {
+          printValue(&I);
+        }
+      }
+      OS << "\n";
+    }
+  }
+
+  /// Print the size of the problem and the work done as one line of JSON
+  auto printStats(raw_ostream &OS) -> void {
+    auto J = json::OStream(OS);
+    J.object([&] {
+      J.attribute("module", M.getName());
+      J.attribute("nodes", int64_t(pts.size()));
+      J.attribute("objects", int64_t(numObjects));
+      J.attribute("copy_edges", int64_t(numCopies));
+      J.attribute("loads", int64_t(numLoads));
+      J.attribute("stores", int64_t(numStores));
+      J.attribute("collapsed", int64_t(numCollapsed));
+      J.attribute("cycle_searches", int64_t(numSearches));
+      J.attribute("iterations", int64_t(iterations));
+      J.attribute("solve_seconds", solveSeconds);
+    });
+    OS << "\n";
+  }
+
+private:
+  auto addNode(Value *V) -> unsigned {
+    auto n = unsigned(pts.size());
+    values.push_back(V);
+    parent.push_back(n);
+    pts.emplace_back();
+    prev.emplace_back();
+    succs.emplace_back();
+    loads.emplace_back();
+    stores.emplace_back();
+    calls.emplace_back();
+    queued.push_back(false);
+    return n;
+  }
+
+  /// Node of the object allocated by `V`
+  auto objectNode(Value *V) -> unsigned {
+    auto [it, inserted] = objects.try_emplace(V, 0);
+    if (inserted) {
+      it->second = addNode(V);
+      numObjects += 1;
+    }
+    return it->second;
+  }
+
+  /// Node of the pointer `V`, or -1 if it cannot point to any object, e.g.
+  /// null. Constant casts and `getelementptr` share the node of the pointer
+  /// they are based on.
+  auto valueNode(Value *V) -> int {
+    if (!V->getType()->isPointerTy()) {
+      return -1;
+    }
+    if (auto CE = dyn_cast<ConstantExpr>(V)) {
+      switch (CE->getOpcode()) {
+      case Instruction::BitCast:
+      case Instruction::AddrSpaceCast:
+      case Instruction::GetElementPtr:
+        return valueNode(CE->getOperand(0));
+      default:
+        return -1;
+      }
+    }
+    if (auto alias = dyn_cast<GlobalAlias>(V)) {
+      return valueNode(alias->getAliasee());
+    }
+    if (!isa<GlobalObject>(V) && !isa<Argument>(V) && !isa<Instruction>(V)) {
+      return -1;
+    }
+
+    auto it = nodes.find(V);
+    if (it != nodes.end()) {
+      return it->second;
+    }
+    auto n = addNode(V);
+    nodes[V] = n;
+    // The address of a global is the global
+    if (isa<GlobalObject>(V)) {
+      addAddr(n, objectNode(V));
+    }
+    return n;
+  }
+
+  auto addAddr(unsigned p, unsigned o) -> void {
+    if (pts[p].test_and_set(o)) {
+      push(p);
+    }
+  }
+
+  /// Copy edge `src -> dst` between representatives. A new edge carries
+  /// the whole set of `src`, later only what is new to it.
+  auto addCopy(unsigned src, unsigned dst) -> void {
+    src = find(src);
+    dst = find(dst);
+    if (src != dst && succs[src].test_and_set(dst)) {
+      numCopies += 1;
+      if (pts[dst] |= pts[src]) {
+        push(dst);
+      }
+    }
+  }
+
+  auto addConstraints(Instruction &I) -> void {
+    // Every pointer operand gets its node now, the solver does not add any
+    for (auto &op : I.operands()) {
+      valueNode(op);
+    }
+    auto self = valueNode(&I);
+
+    switch (I.getOpcode()) {
+    case Instruction::Alloca:
+      addAddr(self, objectNode(&I));
+      break;
+    case Instruction::BitCast:
+    case Instruction::AddrSpaceCast:
+    case Instruction::GetElementPtr:
+      copyFrom(I.getOperand(0), self);
+      break;
+    case Instruction::PtrToInt:
+      copyFrom(I.getOperand(0), escaped);
+      break;
+    case Instruction::IntToPtr:
+      if (self >= 0) {
+        addCopy(escaped, self);
+      }
+      break;
+    case Instruction::PHI:
+      for (auto &op : I.operands()) {
+        copyFrom(op, self);
+      }
+      break;
+    case Instruction::Select:
+      copyFrom(I.getOperand(1), self);
+      copyFrom(I.getOperand(2), self);
+      break;
+    case Instruction::Load: {
+      auto ptr = valueNode(I.getOperand(0));
+      if (self >= 0 && ptr >= 0) {
+        loads[ptr].push_back(self);
+        numLoads += 1;
+        push(ptr);
+      }
+      break;
+    }
+    case Instruction::Store: {
+      auto val = valueNode(I.getOperand(0));
+      auto ptr = valueNode(I.getOperand(1));
+      if (val >= 0 && ptr >= 0) {
+        stores[ptr].push_back(val);
+        numStores += 1;
+        push(ptr);
+      }
+      break;
+    }
+    case Instruction::Ret:
+      if (I.getNumOperands() > 0) {
+        auto it = returnNodes.find(I.getFunction());
+        if (it != returnNodes.end()) {
+          copyFrom(I.getOperand(0), it->second);
+        }
+      }
+      break;
+    case Instruction::Call:
+    case Instruction::Invoke: {
+      auto &call = cast<CallBase>(I);
+      if (auto transfer = dyn_cast<MemTransferInst>(&call)) {
+        addMemTransfer(*transfer);
+      } else if (auto F = call.getCalledFunction()) {
+        bindCall(call, *F);
+      } else if (auto callee = valueNode(call.getCalledOperand());
+                 callee >= 0) {
+        // Bound to every function the callee may point to while solving
+        if (self >= 0) {
+          objectNode(&call);
+        }
+        calls[callee].push_back(&call);
+        push(callee);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  /// Whatever is stored in the source objects is stored in the destination
+  /// objects, through a temporary node: `t = *src; *dst = t`
+  auto addMemTransfer(MemTransferInst &transfer) -> void {
+    auto src = valueNode(transfer.getRawSource());
+    auto dst = valueNode(transfer.getRawDest());
+    if (src < 0 || dst < 0) {
+      return;
+    }
+    auto temp = addNode(nullptr);
+    loads[src].push_back(temp);
+    stores[dst].push_back(temp);
+    numLoads += 1;
+    numStores += 1;
+    push(src);
+    push(dst);
+  }
+
+  /// Pointers in the initializer of a global are stored in it
+  auto addInitializer(Constant *C, unsigned object) -> void {
+    if (C->getType()->isPointerTy()) {
+      copyFrom(C, object);
+    } else if (isa<ConstantAggregate>(C)) {
+      for (auto &op : C->operands()) {
+        addInitializer(cast<Constant>(op), object);
+      }
+    }
+  }
+
+  auto copyFrom(Value *V, int dst) -> void {
+    auto src = valueNode(V);
+    if (src >= 0 && dst >= 0) {
+      addCopy(src, dst);
+    }
+  }
+
+  /// Arguments flow into the parameters of `F`, and its return value into
+  /// the result. External functions returning pointers are allocation
+  /// sites, e.g. `malloc`, their arguments are ignored.
+  auto bindCall(CallBase &call, Function &F) -> void {
+    auto result = nodes.find(&call);
+    if (F.isIntrinsic()) {
+      return;
+    }
+    if (F.isDeclaration()) {
+      if (result != nodes.end()) {
+        addAddr(result->second, objectNode(&call));
+      }
+      return;
+    }
+    for (unsigned i = 0; i < call.arg_size() && i < F.arg_size(); i++) {
+      auto param = nodes.find(F.getArg(i));
+      if (param != nodes.end()) {
+        copyFrom(call.getArgOperand(i), param->second);
+      }
+    }
+    auto ret = returnNodes.find(&F);
+    if (result != nodes.end() && ret != returnNodes.end()) {
+      addCopy(ret->second, result->second);
+    }
+  }
+
+  auto push(unsigned n) -> void {
+    n = find(n);
+    if (!queued[n]) {
+      queued[n] = true;
+      worklist.push_back(n);
+    }
+  }
+
+  /// Representative of the merged node `n` belongs to
+  auto find(unsigned n) -> unsigned {
+    while (parent[n] != n) {
+      parent[n] = parent[parent[n]];
+      n = parent[n];
+    }
+    return n;
+  }
+
+  /// Merge `b` into `a`, both representatives
+  auto unite(unsigned a, unsigned b) -> void {
+    parent[b] = a;
+    pts[a] |= pts[b];
+    // Objects pushed through both were applied to the constraints of both
+    prev[a] &= prev[b];
+    succs[a] |= succs[b];
+    loads[a].append(loads[b].begin(), loads[b].end());
+    stores[a].append(stores[b].begin(), stores[b].end());
+    calls[a].append(calls[b].begin(), calls[b].end());
+    pts[b].clear();
+    prev[b].clear();
+    succs[b].clear();
+    loads[b].clear();
+    stores[b].clear();
+    calls[b].clear();
+    numCollapsed += 1;
+    push(a);
+  }
+
+  /// Find the strongly connected components of copy edges reachable from
+  /// `root` (Tarjan's algorithm, without recursion), and merge each into
+  /// one node
+  auto collapseCycles(unsigned root) -> void {
+    root = find(root);
+    numSearches += 1;
+    struct Frame {
+      unsigned node;
+      SmallVector<unsigned, 4> succs;
+      unsigned next = 0;
+    };
+    auto index = DenseMap<unsigned, unsigned>();
+    auto lowlink = DenseMap<unsigned, unsigned>();
+    auto stack = std::vector<unsigned>();
+    auto onStack = DenseSet<unsigned>();
+    auto frames = std::vector<Frame>();
+
+    auto visit = [&](unsigned n) {
+      auto order = unsigned(index.size());
+      index[n] = order;
+      lowlink[n] = order;
+      stack.push_back(n);
+      onStack.insert(n);
+      auto &frame = frames.emplace_back();
+      frame.node = n;
+      for (auto s : succs[n]) {
+        s = find(s);
+        if (s != n) {
+          frame.succs.push_back(s);
+        }
+      }
+    };
+
+    visit(root);
+    while (!frames.empty()) {
+      auto &frame = frames.back();
+      auto n = frame.node;
+      if (frame.next < frame.succs.size()) {
+        auto s = frame.succs[frame.next++];
+        if (!index.count(s)) {
+          visit(s);
+        } else if (onStack.count(s)) {
+          lowlink[n] = std::min(lowlink[n], index[s]);
+        }
+        continue;
+      }
+
+      frames.pop_back();
+      if (!frames.empty()) {
+        auto caller = frames.back().node;
+        lowlink[caller] = std::min(lowlink[caller], lowlink[n]);
+      }
+      if (lowlink[n] == index[n]) {
+        while (true) {
+          auto m = stack.back();
+          stack.pop_back();
+          onStack.erase(m);
+          if (m == n) {
+            break;
+          }
+          unite(n, m);
+        }
+      }
+    }
+  }
+
+  /// `function:%name` for locals, `@name` for globals and functions
+  auto objectNames(ModuleSlotTracker &MST) -> std::vector<std::string> {
+    auto names = std::vector<std::string>(values.size());
+    names[unknown] = "unknown";
+    for (auto &G : M.global_objects()) {
+      auto OS = raw_string_ostream(names[objects.lookup(&G)]);
+      G.printAsOperand(OS, /*PrintType=*/false, MST);
+    }
+    for (auto &F : M) {
+      if (F.isDeclaration()) {
+        continue;
+      }
+      MST.incorporateFunction(F);
+      for (auto &BB : F) {
+        for (auto &I : BB) {
+          auto it = objects.find(&I);
+          if (it != objects.end()) {
+            auto OS = raw_string_ostream(names[it->second]);
+            OS << F.getName() << ":";
+            I.printAsOperand(OS, /*PrintType=*/false, MST);
+          }
+        }
+      }
+    }
+    return names;
+  }
+
+  Module &M;
+  /// Nodes of pointer values, of the objects allocated by allocation sites,
+  /// and of the return values of functions returning pointers
+  DenseMap<Value *, unsigned> nodes;
+  DenseMap<Value *, unsigned> objects;
+  DenseMap<Function *, unsigned> returnNodes;
+  /// Object of memory not allocated in the module, and the node of every
+  /// address converted to an integer
+  unsigned unknown;
+  unsigned escaped;
+
+  /// Per node: its value (the allocation site of objects), union-find
+  /// parent, points-to set, the part of it already propagated, copy edges,
+  /// and the loads, stores and indirect calls through it
+  std::vector<Value *> values;
+  std::vector<unsigned> parent;
+  std::vector<NodeSet> pts;
+  std::vector<NodeSet> prev;
+  std::vector<NodeSet> succs;
+  std::vector<SmallVector<unsigned, 1>> loads;
+  std::vector<SmallVector<unsigned, 1>> stores;
+  std::vector<SmallVector<CallBase *, 0>> calls;
+
+  std::vector<unsigned> worklist;
+  std::vector<bool> queued;
+  /// Edges that already triggered a cycle search
+  DenseSet<std::pair<unsigned, unsigned>> checkedEdges;
+
+  uint64_t numObjects = 0;
+  uint64_t numCopies = 0;
+  uint64_t numLoads = 0;
+  uint64_t numStores = 0;
+  uint64_t numCollapsed = 0;
+  uint64_t numSearches = 0;
+  uint64_t iterations = 0;
+  double solveSeconds = 0;
+};
+
+namespace {
+/// `andersen<stats;quiet>`: solve and print the points-to sets of the
+/// module. `stats` also prints the size of the constraint graph and the work
+/// done as JSON, `quiet` skips the points-to sets.
+struct AndersenPass : public PassInfoMixin<AndersenPass> {
+  AndersenPass(const PassParams &params)
+      : stats(params.count("stats")), quiet(params.count("quiet")) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    auto graph = ConstraintGraph(M);
+    graph.solve();
+    if (!quiet) {
+      graph.print(errs());
+    }
+    if (stats) {
+      graph.printStats(errs());
+    }
+    return PreservedAnalyses::all();
+  }
+
+  bool stats;
+  bool quiet;
+};
+} // namespace
+
+extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
+llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, PASS_NAME, PASS_VERSION,
+          [](PassBuilder &PB) {
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (auto params = parsePassParams(Name, ARGUMENT_NAME)) {
+                    MPM.addPass(AndersenPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+          }};
+}
@@ -1,18 +1,187 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 
-// Branch (taken, total) pair
-std::pair<int, int> BrCount;
+#include "BranchProfile.h"
+#include "SamplingRuntime.h"
+#include "ShardedCounters.h"
+
+// Branch (taken, total) pair, modified by any number of threads
+using BrCount = ShardedCounters<struct BrCountTag, 2>;
+
+// (taken, total) pair updated inline by `bb<inline>` / `bb<select>`. Written
+// directly by instrumented code, i.e. meant for single-threaded programs.
+extern "C" {
+uint64_t __brCounts__[2] = {};
+}
 
 extern "C" auto __updateBrCount__(bool taken) {
-  BrCount.first += static_cast<int>(taken);
-  BrCount.second += 1;
+  BrCount::add(0, static_cast<int>(taken));
+  BrCount::add(1, 1);
+}
+
+// Sampled (taken, total) pair of `bb<sample=N>`, scaled by the period of
+// the module that took the samples (indices 0 and 1), and the variances of
+// these estimates (indices 2 and 3)
+using BrSamples = ShardedCounters<struct BrSamplesTag, 4>;
+
+// Slow path of `bb<sample=N>`, return the number of branches until the next
+// sample of the calling thread. Each sample counts 0 or 1, so its square is
+// itself.
+extern "C" auto __sampleBrCount__(bool taken, uint64_t period) -> int64_t {
+  BrSamples::add(0, period * static_cast<int>(taken));
+  BrSamples::add(1, period);
+  BrSamples::add(2, sampleVariance(period, static_cast<int>(taken)));
+  BrSamples::add(3, sampleVariance(period, 1));
+  return nextCountdown(period);
+}
+
+// Branch sites of one module instrumented by `bb<sites>`
+struct BranchSites {
+  uint64_t *counters;
+  uint32_t numSites;
+  const uint32_t *lines;
+  const char *descriptions;
+  uint32_t descriptionSize;
+  // Sampling period, 1 if the module counts every branch
+  uint64_t period;
+};
+
+// Registered by global constructors, possibly before the globals of this
+// file are initialized, hence constructed on first use. Never destroyed, so
+// that it outlives the flush at exit.
+static auto registeredBranchSites() -> std::vector<BranchSites> & {
+  static auto registered = new std::vector<BranchSites>();
+  return *registered;
+}
+
+// Serializes reports and registration
+static std::mutex reportMutex;
+
+// Write the counters of all registered modules, see `BranchProfile.h`
+static auto writeBranchProfile() -> void {
+  using namespace BranchProfile;
+
+  auto data = std::string();
+  appendU32(data, MAGIC);
+  appendU32(data, VERSION);
+  for (auto &module : registeredBranchSites()) {
+    appendU32(data, module.numSites);
+    appendU32(data, module.descriptionSize);
+    appendU64(data, module.period);
+    for (uint32_t site = 0; site < module.numSites; site++) {
+      appendU32(data, module.lines[site]);
+    }
+    for (uint32_t i = 0; i < 2 * module.numSites; i++) {
+      appendU64(data, module.counters[i]);
+    }
+    data.append(module.descriptions, module.descriptionSize);
+  }
+
+  auto path = std::getenv("BRANCH_PROFILE");
+  auto file = std::fopen(path != nullptr ? path : DEFAULT_PATH, "wb");
+  if (file == nullptr ||
+      std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+    std::cerr << "cannot write branch profile\n";
+  }
+  if (file != nullptr) {
+    std::fclose(file);
+  }
+}
+
+extern "C" auto __registerBranchSites__(uint64_t *counters, uint32_t numSites,
+                                        const uint32_t *lines,
+                                        const char *descriptions,
+                                        uint32_t descriptionSize,
+                                        uint64_t period) -> void {
+  auto lock = std::lock_guard<std::mutex>(reportMutex);
+  registeredBranchSites().push_back(
+      {counters, numSites, lines, descriptions, descriptionSize, period});
+}
+
+// Add to counter `index` of a module. Counters live in the instrumented
+// module and are shared by all threads, hence the atomic add. Relaxed is
+// enough since they are only read after the threads are done.
+static auto addBrSite(uint64_t *counters, uint32_t index, uint64_t count)
+    -> void {
+  __atomic_fetch_add(&counters[index], count, __ATOMIC_RELAXED);
+}
+
+// Slow path of `bb<sites;sample=N>`, records one sample and returns the
+// next countdown. Scaling is left to the reader of the profile, which gets
+// the period of the module.
+extern "C" auto __sampleBrSite__(uint64_t *counters, uint32_t site, bool taken,
+                                 uint64_t period) -> int64_t {
+  addBrSite(counters, 2 * site, static_cast<int>(taken));
+  addBrSite(counters, 2 * site + 1, 1);
+  return nextCountdown(period);
+}
+
+extern "C" auto __updateBrSite__(uint64_t *counters, uint32_t site,
+                                 bool taken) -> void {
+  addBrSite(counters, 2 * site, static_cast<int>(taken));
+  addBrSite(counters, 2 * site + 1, 1);
+}
+
+// Print the (taken, total) pair counted since the last report, unless it is
+// zero and `always` is false
+static auto reportBrCount(bool always) -> void {
+  uint64_t counts[2] = {};
+  BrCount::drain([&](size_t index, uint64_t count) { counts[index] = count; });
+  for (auto i = 0; i < 2; i++) {
+    counts[i] += __brCounts__[i];
+    __brCounts__[i] = 0;
+  }
+
+  // Add sampled estimates, printed with the half-width of their ~95%
+  // confidence interval
+  uint64_t samples[4] = {};
+  BrSamples::drain(
+      [&](size_t index, uint64_t count) { samples[index] = count; });
+  if (!always && counts[1] == 0 && samples[1] == 0) {
+    return;
+  }
+
+  const char *names[2] = {"taken", "total"};
+  for (auto i = 0; i < 2; i++) {
+    std::cerr << names[i] << "\t" << counts[i] + samples[i];
+    if (samples[1] != 0) {
+      std::cerr << "\t+-" << std::llround(confidenceBound(samples[2 + i]));
+    }
+    std::cerr << "\n";
+  }
 }
 
 extern "C" auto __printAndClearBrCount__() {
-  std::cerr << "taken"
-            << "\t" << BrCount.first << "\n";
-  std::cerr << "total"
-            << "\t" << BrCount.second << "\n";
-  BrCount = {0, 0};
-}
\ No newline at end of file
+  auto lock = std::lock_guard<std::mutex>(reportMutex);
+  reportBrCount(true);
+}
+
+// Report once, no matter how many threads or exit paths call it: print the
+// (taken, total) pair and write the profile of `bb<sites>`, if used. Called
+// at exit, programs may call it earlier, e.g. before `_exit`.
+extern "C" auto __flushBrCount__() -> void {
+  static std::atomic<bool> flushed = false;
+  if (flushed.exchange(true)) {
+    return;
+  }
+
+  auto lock = std::lock_guard<std::mutex>(reportMutex);
+  // Programs only instrumented with `bb<sites>` do not print an empty pair
+  auto sites = !registeredBranchSites().empty();
+  reportBrCount(!sites);
+  if (sites) {
+    writeBranchProfile();
+  }
+}
+
+// Flush when the program exits, whether `main` returns or `exit` is called
+// anywhere. Instrumented code does not print anything itself.
+static struct FlushAtExit {
+  ~FlushAtExit() { __flushBrCount__(); }
+} flushAtExit;
\ No newline at end of file
@@ -1,21 +1,42 @@
 #pragma once
 
-#include <map>
+#include <type_traits>
+#include <vector>
 
+#include "llvm/ADT/DenseMap.h"
+
+/// One-to-one mapping between keys and small unsigned numbers, e.g.
+/// instructions and the numbers they are printed as. Numbers index a vector
+/// and keys a hash map, so both directions are O(1) without rebalancing
+/// trees or comparing keys. Numbers should be dense, gaps cost a null entry.
 template <typename U, typename V> class Bimap {
+  static_assert(std::is_unsigned_v<V>, "numbers index a vector");
+
 private:
-  std::map<U, V> A2BMap;
-  std::map<V, U> B2AMap;
+  llvm::DenseMap<U, V> A2BMap;
+  std::vector<U> B2AVector;
 
 public:
-  auto insert(U a, V b) { insert(b, a); }
-
-  auto insert(V b, U a) {
+  auto insert(U a, V b) -> void {
     A2BMap.insert({a, b});
-    B2AMap.insert({b, a});
+    if (B2AVector.size() <= b) {
+      B2AVector.resize(b + 1);
+    }
+    B2AVector[b] = a;
   }
 
-  auto operator[](U a) { return A2BMap[a]; }
+  auto insert(V b, U a) -> void { insert(a, b); }
 
-  auto operator[](V b) { return B2AMap[b]; }
-};
\ No newline at end of file
+  auto reserve(size_t size) -> void {
+    A2BMap.reserve(size);
+    B2AVector.reserve(size + 1);
+  }
+
+  /// Number of `a`, 0 if absent
+  auto operator[](U a) const -> V { return A2BMap.lookup(a); }
+
+  /// Key numbered `b`, null if absent
+  auto operator[](V b) const -> U {
+    return b < B2AVector.size() ? B2AVector[b] : U();
+  }
+};
@@ -1,7 +1,13 @@
 #include <map>
+#include <string>
+#include <vector>
 
+#include "HelperFunctions.h"
+#include "Instrumentation.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
@@ -9,8 +15,65 @@ static auto PASS_NAME = "ProfileBranchBiasPass";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "bb";
 
+/// How a conditional branch updates its counters
+enum CounterMode {
+  /// Call the runtime
+  Calls,
+  /// Zero-extend the condition and add it to the taken counter inline
+  Inline,
+  /// Like `Inline`, but select between the old and the incremented count
+  Select,
+  /// Decrement a thread-local countdown per branch, and only call the
+  /// runtime when it expires. The runtime scales the samples back up.
+  Sampled,
+};
+
+/// Counter mode selected by the `inline` / `select` / `sample=N` pass
+/// parameters
+static auto parseCounterMode(const PassParams &params) -> CounterMode {
+  if (params.count("sample")) {
+    return CounterMode::Sampled;
+  } else if (params.count("select")) {
+    return CounterMode::Select;
+  } else if (params.count("inline")) {
+    return CounterMode::Inline;
+  } else {
+    return CounterMode::Calls;
+  }
+}
+
+/// Average number of branches between samples, 1000 unless given by
+/// `sample=N`
+static auto parseSamplePeriod(const PassParams &params) -> uint64_t {
+  return parsePositiveParam(params, "sample", 1000);
+}
+
+/// Insert code counting a branch on `cond` before the insertion point of
+/// `builder`: `counters[taken] += cond` and `counters[total] += 1`, without
+/// any call or control flow
+static auto countBranch(IRBuilder<> &builder, ArrayType *countersType,
+                        Constant *counters, unsigned taken, unsigned total,
+                        Value *cond, CounterMode mode) -> void {
+  if (mode == CounterMode::Select) {
+    auto counter =
+        builder.CreateConstInBoundsGEP2_64(countersType, counters, 0, taken);
+    auto count = builder.CreateLoad(builder.getInt64Ty(), counter);
+    auto incremented = builder.CreateAdd(count, builder.getInt64(1));
+    builder.CreateStore(builder.CreateSelect(cond, incremented, count),
+                        counter);
+  } else {
+    incrementCounter(builder, countersType, counters, taken,
+                     builder.CreateZExt(cond, builder.getInt64Ty()));
+  }
+  incrementCounter(builder, countersType, counters, total,
+                   builder.getInt64(1));
+}
+
 namespace {
 struct ProfileBranchBiasPass : public PassInfoMixin<ProfileBranchBiasPass> {
+  ProfileBranchBiasPass(const PassParams &params)
+      : mode(parseCounterMode(params)), period(parseSamplePeriod(params)) {}
+
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
     auto M = F.getParent();
     auto &CTX = M->getContext();
@@ -18,6 +81,20 @@ struct ProfileBranchBiasPass : public PassInfoMixin<ProfileBranchBiasPass> {
     auto updateType =
         FunctionType::get(Type::getVoidTy(CTX), {Type::getInt1Ty(CTX)}, false);
     auto updateFunc = M->getOrInsertFunction("__updateBrCount__", updateType);
+    auto sampleType = FunctionType::get(
+        Type::getInt64Ty(CTX), {Type::getInt1Ty(CTX), Type::getInt64Ty(CTX)},
+        false);
+
+    // `uint64_t __brCounts__[2]`, the (taken, total) pair updated inline,
+    // defined by the runtime
+    auto countersType = ArrayType::get(Type::getInt64Ty(CTX), 2);
+    auto counters = mode == CounterMode::Inline || mode == CounterMode::Select
+                        ? M->getOrInsertGlobal("__brCounts__", countersType)
+                        : nullptr;
+
+    // Sampled branches are only instrumented after iterating, since that
+    // splits blocks
+    std::vector<BranchInst *> sampled;
 
     for (auto &BB : F) {
       // No need to iterate over every instruction.
@@ -36,22 +113,162 @@ struct ProfileBranchBiasPass : public PassInfoMixin<ProfileBranchBiasPass> {
           auto Cond = BrInstr->getCondition();
           assert(Cond->getType() == Type::getInt1Ty(CTX));
 
-          // Insert call to update `BrCount` pair
-          CallInst::Create(updateFunc, {Cond}, "", terminator);
+          if (mode == CounterMode::Calls) {
+            // Insert call to update `BrCount` pair
+            CallInst::Create(updateFunc, {Cond}, "", terminator);
+          } else if (mode == CounterMode::Sampled) {
+            sampled.push_back(BrInstr);
+          } else {
+            auto builder = IRBuilder<>(terminator);
+            countBranch(builder, countersType, counters, 0, 1, Cond, mode);
+          }
         }
       }
     }
 
-    // Construct function signature and insert call to
-    // print out count of branches taken
-    auto printType = FunctionType::get(Type::getVoidTy(CTX), false);
-    auto printFunc =
-        M->getOrInsertFunction("__printAndClearBrCount__", printType);
-    auto retInstr = F.back().getTerminator();
-    CallInst::Create(printFunc, "", retInstr);
+    // Call `__sampleBrCount__` when `__branchCountdown__` expires
+    for (auto BrInstr : sampled) {
+      auto sampleFunc =
+          M->getOrInsertFunction("__sampleBrCount__", sampleType);
+      insertSampleCall(BrInstr, "__branchCountdown__", sampleFunc,
+                       {BrInstr->getCondition(),
+                        ConstantInt::get(Type::getInt64Ty(CTX), period)});
+    }
+
+    // No print call is inserted, the runtime prints the counts once when the
+    // program exits
 
     return PreservedAnalyses::none();
   }
+
+  CounterMode mode;
+  uint64_t period;
+};
+
+/// Module pass giving every conditional branch of the module its own
+/// (taken, total) counter pair, selected by `bb<sites>`.
+///
+/// Sites are numbered in layout order and counted in a module-level array.
+/// A global constructor registers the array with the runtime, together with
+/// the function, block and source line of each site, and the runtime dumps
+/// them into a binary profile at exit (see `BranchProfile.h`).
+struct BranchSitesPass : public PassInfoMixin<BranchSitesPass> {
+  BranchSitesPass(const PassParams &params)
+      : mode(parseCounterMode(params)), period(parseSamplePeriod(params)) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    auto &CTX = M.getContext();
+
+    // Function and block name of each site, each followed by '\0', and
+    // source lines
+    std::vector<BranchInst *> sites;
+    std::string descriptions;
+    std::vector<uint32_t> lines;
+    for (auto &F : M) {
+      auto blockIndex = 0;
+      for (auto &BB : F) {
+        auto BrInstr = dyn_cast<BranchInst>(BB.getTerminator());
+        if (BrInstr != nullptr && BrInstr->isConditional()) {
+          sites.push_back(BrInstr);
+          descriptions += F.getName();
+          descriptions += '\0';
+          descriptions += BB.hasName() ? BB.getName().str()
+                                       : "#" + std::to_string(blockIndex);
+          descriptions += '\0';
+          auto &loc = BrInstr->getDebugLoc();
+          lines.push_back(loc ? loc.getLine() : 0);
+        }
+        blockIndex += 1;
+      }
+    }
+    if (sites.empty()) {
+      return PreservedAnalyses::all();
+    }
+
+    auto builder = IRBuilder<>(CTX);
+    auto countersType = ArrayType::get(builder.getInt64Ty(), 2 * sites.size());
+    auto counters = new GlobalVariable(
+        M, countersType, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(countersType), "__branchSites__");
+    auto countersPtr =
+        ConstantExpr::getInBoundsGetElementPtr(countersType, counters,
+                                               ArrayRef<Constant *>{
+                                                   builder.getInt64(0),
+                                                   builder.getInt64(0)});
+
+    // Insert code / call to update the counters of the site
+    auto updateType = FunctionType::get(
+        builder.getVoidTy(),
+        {countersPtr->getType(), builder.getInt32Ty(), builder.getInt1Ty()},
+        false);
+    auto sampleType = FunctionType::get(
+        builder.getInt64Ty(),
+        {countersPtr->getType(), builder.getInt32Ty(), builder.getInt1Ty(),
+         builder.getInt64Ty()},
+        false);
+    for (unsigned site = 0; site < sites.size(); site++) {
+      auto cond = sites[site]->getCondition();
+      if (mode == CounterMode::Sampled) {
+        // Raw samples, scaled up by the reader of the profile
+        auto sampleFunc =
+            M.getOrInsertFunction("__sampleBrSite__", sampleType);
+        insertSampleCall(sites[site], "__branchCountdown__", sampleFunc,
+                         {countersPtr, builder.getInt32(site), cond,
+                          builder.getInt64(period)});
+      } else if (mode == CounterMode::Calls) {
+        auto updateFunc =
+            M.getOrInsertFunction("__updateBrSite__", updateType);
+        CallInst::Create(updateFunc,
+                         {countersPtr, builder.getInt32(site), cond}, "",
+                         sites[site]);
+      } else {
+        builder.SetInsertPoint(sites[site]);
+        countBranch(builder, countersType, counters, 2 * site, 2 * site + 1,
+                    cond, mode);
+      }
+    }
+
+    // Constructor handing everything to the runtime once
+    auto linesInit = ConstantDataArray::get(CTX, lines);
+    auto linesVar = new GlobalVariable(M, linesInit->getType(), true,
+                                       GlobalValue::PrivateLinkage, linesInit,
+                                       "__branchSiteLines__");
+    auto descriptionsInit =
+        ConstantDataArray::getString(CTX, descriptions, false);
+    auto descriptionsVar = new GlobalVariable(
+        M, descriptionsInit->getType(), true, GlobalValue::PrivateLinkage,
+        descriptionsInit, "__branchSiteDescriptions__");
+
+    auto registerType = FunctionType::get(
+        builder.getVoidTy(),
+        {countersPtr->getType(), builder.getInt32Ty(),
+         builder.getInt32Ty()->getPointerTo(),
+         builder.getInt8Ty()->getPointerTo(), builder.getInt32Ty(),
+         builder.getInt64Ty()},
+        false);
+    auto registerFunc =
+        M.getOrInsertFunction("__registerBranchSites__", registerType);
+    auto ctor = Function::Create(FunctionType::get(builder.getVoidTy(), false),
+                                 GlobalValue::InternalLinkage,
+                                 "__registerBranchSites__.ctor", M);
+    builder.SetInsertPoint(BasicBlock::Create(CTX, "", ctor));
+    builder.CreateCall(
+        registerFunc,
+        {countersPtr, builder.getInt32(sites.size()),
+         builder.CreateConstInBoundsGEP2_64(linesInit->getType(), linesVar, 0,
+                                            0),
+         builder.CreateConstInBoundsGEP2_64(descriptionsInit->getType(),
+                                            descriptionsVar, 0, 0),
+         builder.getInt32(descriptions.size()),
+         builder.getInt64(mode == CounterMode::Sampled ? period : 1)});
+    builder.CreateRetVoid();
+    appendToGlobalCtors(M, ctor, 0);
+
+    return PreservedAnalyses::none();
+  }
+
+  CounterMode mode;
+  uint64_t period;
 };
 } // namespace
 
@@ -62,8 +279,21 @@ llvmGetPassPluginInfo() {
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == ARGUMENT_NAME) {
-                    FPM.addPass(ProfileBranchBiasPass());
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && !params->count("sites")) {
+                    FPM.addPass(ProfileBranchBiasPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && params->count("sites")) {
+                    // Separate counters for every branch of the module
+                    MPM.addPass(BranchSitesPass(*params));
                     return true;
                   } else {
                     return false;
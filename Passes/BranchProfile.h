@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/// Binary branch profile written at exit by programs instrumented with
+/// `bb<sites>`, and read back by `ReadBranchProfile`.
+///
+/// All integers are little endian. The file starts with `MAGIC` and
+/// `VERSION` (u32 each), followed by one record per instrumented module:
+///
+///   u32 numSites
+///   u32 descriptionSize
+///   u64 period                   1 if every branch is counted, otherwise
+///                                the average number of branches between
+///                                two samples of `bb<sites;sample=N>`
+///   u32 lines[numSites]          source line of each site, 0 if unknown
+///   u64 counts[2 * numSites]     (taken, total) of each site, in samples
+///                                if `period` is not 1
+///   char descriptions[descriptionSize]
+///                                function and block name of each site,
+///                                each terminated by '\0'
+///
+/// Site `i` of a module is the `i`-th conditional branch in layout order.
+/// Sampled counts are kept raw, so that readers can both scale them up and
+/// bound their error.
+namespace BranchProfile {
+static constexpr uint32_t MAGIC = 0x46504242; // "BBPF"
+static constexpr uint32_t VERSION = 2;
+
+/// Output file, unless overridden by the `BRANCH_PROFILE` environment
+/// variable
+static constexpr auto DEFAULT_PATH = "branch-profile.bin";
+
+static inline auto appendU32(std::string &data, uint32_t value) -> void {
+  for (auto shift = 0; shift < 32; shift += 8) {
+    data.push_back(char(value >> shift));
+  }
+}
+
+static inline auto appendU64(std::string &data, uint64_t value) -> void {
+  appendU32(data, uint32_t(value));
+  appendU32(data, uint32_t(value >> 32));
+}
+} // namespace BranchProfile
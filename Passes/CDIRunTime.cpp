@@ -1,26 +1,147 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
-#include <map>
+#include <mutex>
+#include <vector>
 
-#include "HelperFunctions.h"
+#include "SamplingRuntime.h"
+#include "ShardedCounters.h"
 #include "llvm/IR/Instruction.h"
 
 // Store opcode instead of string to avoid memory allocation issues.
-// Modified at run time
-std::map<unsigned, int> InstrCount;
+// Modified at run time, by any number of threads
+using InstrCount =
+    ShardedCounters<struct InstrCountTag, llvm::Instruction::OtherOpsEnd>;
+
+// Counters incremented inline by `cdi<inline>`, indexed by opcode.
+// Unlike `InstrCount`, these and the `cdi<block>` counters are plain
+// globals updated by instrumented code, i.e. meant for single-threaded
+// programs. Wide enough not to overflow in hot loops.
+extern "C" {
+uint64_t __instrCounts__[llvm::Instruction::OtherOpsEnd] = {};
+}
+
+// Samples of `cdi<sample=N>`, scaled by the period of the module that took
+// them: per opcode, the estimated count (index `opcode`) and its variance
+// (index `OtherOpsEnd + opcode`), so that modules sampled with different
+// periods can be added up
+using InstrSamples =
+    ShardedCounters<struct InstrSamplesTag,
+                    2 * llvm::Instruction::OtherOpsEnd>;
+
+// Slow path of `cdi<sample=N>`, `entry` holds the static opcode counts of
+// the sampled block: `number of opcodes, opcode, count, ...`. Return the
+// number of blocks until the next sample of the calling thread.
+extern "C" auto __sampleInstrCounts__(const uint32_t *entry, uint64_t period)
+    -> int64_t {
+  auto numOpcodes = *entry++;
+  for (uint32_t i = 0; i < numOpcodes; i++, entry += 2) {
+    InstrSamples::add(entry[0], period * entry[1]);
+    InstrSamples::add(llvm::Instruction::OtherOpsEnd + entry[0],
+                      sampleVariance(period, uint64_t(entry[1]) * entry[1]));
+  }
+  return nextCountdown(period);
+}
+
+// Block counters of one module instrumented by `cdi<block>`, and the static
+// opcode counts of its blocks: `number of opcodes, opcode, count, ...` each
+struct BlockCounts {
+  uint64_t *counters;
+  const uint32_t *table;
+  uint32_t numBlocks;
+};
+
+// Registered by global constructors, possibly before the globals of this
+// file are initialized, hence constructed on first use. Never destroyed, so
+// that it outlives the flush at exit.
+static auto registeredBlockCounts() -> std::vector<BlockCounts> & {
+  static auto registered = new std::vector<BlockCounts>();
+  return *registered;
+}
+
+// Serializes reports and registration
+static std::mutex reportMutex;
+
+extern "C" auto __registerBlockCounts__(uint64_t *counters,
+                                        const uint32_t *table,
+                                        uint32_t numBlocks) -> void {
+  auto lock = std::lock_guard<std::mutex>(reportMutex);
+  registeredBlockCounts().push_back({counters, table, numBlocks});
+}
 
 // `extern "C"` is necessary for keeping the compiler from mangling
 // function names. Remove this line and the linker will complain that
 // there are no reference to `__updateInstrCount__`
 extern "C" auto __updateInstrCount__(unsigned opcode, int count) -> void {
-  // Add to InstrCount map if opcode not seen, otherwise increment count
-  mapInsertOrIncrement(InstrCount, opcode, count);
+  // Add to the counters of the calling thread
+  InstrCount::add(opcode, count);
 }
 
+// Print everything counted since the last report
 extern "C" auto __printAndClearInstrCount__() {
-  for (auto &[key, value] : InstrCount) {
-    auto name = llvm::Instruction::getOpcodeName(key);
-    std::cerr << name << "\t" << value << "\n";
+  auto lock = std::lock_guard<std::mutex>(reportMutex);
+  uint64_t totals[llvm::Instruction::OtherOpsEnd] = {};
+  InstrCount::drain([&](unsigned opcode, uint64_t count) {
+    totals[opcode] += count;
+  });
+
+  // Add counters of `cdi<inline>`
+  for (unsigned opcode = 0; opcode < llvm::Instruction::OtherOpsEnd; opcode++) {
+    totals[opcode] += __instrCounts__[opcode];
+    __instrCounts__[opcode] = 0;
+  }
+
+  // Multiply block counts back into opcode counts
+  for (auto &function : registeredBlockCounts()) {
+    auto entry = function.table;
+    for (uint32_t b = 0; b < function.numBlocks; b++) {
+      auto numOpcodes = *entry++;
+      for (uint32_t i = 0; i < numOpcodes; i++, entry += 2) {
+        totals[entry[0]] += function.counters[b] * entry[1];
+      }
+      function.counters[b] = 0;
+    }
   }
 
-  InstrCount.clear();
-}
\ No newline at end of file
+  // Add sampled estimates, sampled opcodes are printed with the half-width
+  // of their ~95% confidence interval
+  uint64_t variances[llvm::Instruction::OtherOpsEnd] = {};
+  auto sampled = std::vector<bool>(llvm::Instruction::OtherOpsEnd);
+  InstrSamples::drain([&](unsigned index, uint64_t count) {
+    if (index < llvm::Instruction::OtherOpsEnd) {
+      totals[index] += count;
+      sampled[index] = true;
+    } else {
+      variances[index - llvm::Instruction::OtherOpsEnd] = count;
+    }
+  });
+
+  // Opcodes in increasing order, like iterating the former map
+  for (unsigned opcode = 0; opcode < llvm::Instruction::OtherOpsEnd; opcode++) {
+    if (totals[opcode] != 0) {
+      auto name = llvm::Instruction::getOpcodeName(opcode);
+      std::cerr << name << "\t" << totals[opcode];
+      if (sampled[opcode]) {
+        std::cerr << "\t+-"
+                  << std::llround(confidenceBound(variances[opcode]));
+      }
+      std::cerr << "\n";
+    }
+  }
+}
+
+// Print the report once, no matter how many threads or exit paths call it.
+// Called at exit, programs may call it earlier, e.g. before `_exit`.
+extern "C" auto __flushInstrCount__() -> void {
+  static std::atomic<bool> flushed = false;
+  if (!flushed.exchange(true)) {
+    __printAndClearInstrCount__();
+  }
+}
+
+// Flush when the program exits, whether `main` returns or `exit` is called
+// anywhere. Instrumented code does not print anything itself.
+static struct FlushAtExit {
+  ~FlushAtExit() { __flushInstrCount__(); }
+} flushAtExit;
\ No newline at end of file
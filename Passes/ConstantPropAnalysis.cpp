@@ -13,10 +13,10 @@ public:
   ConstInfo() {}
   ConstInfo(std::set<Value *> set) : consts(set) {}
 
-  auto print(Bimap<Instruction *, unsigned> &instrMap) -> void {
+  auto print(raw_ostream &OS, const Bimap<Instruction *, unsigned> &) -> void {
     for (auto &def : consts) {
-      errs() << "\n";
-      def->printAsOperand(errs());
+      OS << "\n";
+      def->printAsOperand(OS);
     }
   }
 
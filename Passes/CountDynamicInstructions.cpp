@@ -1,11 +1,14 @@
 #include <map>
+#include <vector>
 
 #include "HelperFunctions.h"
+#include "Instrumentation.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
@@ -13,9 +16,45 @@ static auto PASS_NAME = "CountDynamicInstrPass";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "cdi";
 
+/// How instrumented blocks update the dynamic instruction counts
+enum CounterMode {
+  /// Call `__updateInstrCount__` once per opcode
+  Calls,
+  /// Add to `__instrCounts__[opcode]` inline, once per opcode
+  Inline,
+  /// Decrement a thread-local countdown per block, and only call the
+  /// runtime with the static opcode counts of the block when it expires.
+  /// The runtime scales the sampled counts back up.
+  Sampled,
+};
+
+/// Append the static opcode counts of a block to `table`, as
+/// `number of opcodes, opcode, count, opcode, count, ...`
+static auto appendOpcodeCounts(std::vector<uint32_t> &table,
+                               const std::map<unsigned, int> &instrCount)
+    -> void {
+  table.push_back(instrCount.size());
+  for (auto &[key, value] : instrCount) {
+    table.push_back(key);
+    table.push_back(value);
+  }
+}
+
 namespace {
 struct CountDynamicInstrPass : public PassInfoMixin<CountDynamicInstrPass> {
+  /// The `inline` and `sample=N` parameters select the counter mode.
+  /// Sampling takes one sample every 1000 blocks by default.
+  CountDynamicInstrPass(const PassParams &params)
+      : mode(params.count("sample")   ? CounterMode::Sampled
+             : params.count("inline") ? CounterMode::Inline
+                                      : CounterMode::Calls),
+        period(parsePositiveParam(params, "sample", 1000)) {}
+
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
+    if (F.isDeclaration()) {
+      return PreservedAnalyses::all();
+    }
+
     // LLVM Module, Context, Function, BasicBlock, and Instruction
     // are often abbreviated by their initials
     auto M = F.getParent();
@@ -23,11 +62,26 @@ struct CountDynamicInstrPass : public PassInfoMixin<CountDynamicInstrPass> {
     auto &CTX = M->getContext();
 
     auto i32Ty = IntegerType::getInt32Ty(CTX);
+    auto i64Ty = IntegerType::getInt64Ty(CTX);
     auto updateType = // (return type, {parameter type, ...}, is_variadic)
         FunctionType::get(IntegerType::getVoidTy(CTX), {i32Ty, i32Ty}, false);
     auto updateFunc = // (symbol name, function type)
         M->getOrInsertFunction("__updateInstrCount__", updateType);
 
+    // `uint64_t __instrCounts__[Instruction::OtherOpsEnd]` is defined by the
+    // runtime
+    auto countersType = ArrayType::get(i64Ty, Instruction::OtherOpsEnd);
+    Constant *counters = nullptr;
+    if (mode == CounterMode::Inline) {
+      counters = M->getOrInsertGlobal("__instrCounts__", countersType);
+    }
+
+    // Static opcode counts of every sampled block
+    std::vector<uint32_t> table;
+    // Sampled blocks and the offset of their entry in `table`. Blocks are
+    // split only after counting, so that the sampling code is not counted.
+    std::vector<std::pair<BasicBlock *, unsigned>> sampled;
+
     // Temporary map for storing instruction counts in each basic block
     // Modified at compile time
     std::map<unsigned, int> instrCount;
@@ -37,30 +91,45 @@ struct CountDynamicInstrPass : public PassInfoMixin<CountDynamicInstrPass> {
         mapInsertOrIncrement(instrCount, I.getOpcode(), 1);
       }
 
-      // For each entry (opcode, count) in the temporary map,
-      // insert a call to `__updateInstrCount__` before any `br`
-      // instruction, i.e exiting the basic block.
-      for (auto &[key, value] : instrCount) {
-        auto terminator = BB.getTerminator();
-        auto opcode = ConstantInt::get(i32Ty, key);
-        auto count = ConstantInt::get(i32Ty, value);
-        // Insert `updateFunc` with argument (key, value) before `terminator`
-        CallInst::Create(updateFunc, {opcode, count}, "", terminator);
+      // Counts are updated before any `br` instruction, i.e exiting the
+      // basic block
+      auto terminator = BB.getTerminator();
+      auto builder = IRBuilder<>(terminator);
+      switch (mode) {
+      case CounterMode::Calls:
+        // For each entry (opcode, count) in the temporary map,
+        // insert a call to `__updateInstrCount__`
+        for (auto &[key, value] : instrCount) {
+          auto opcode = ConstantInt::get(i32Ty, key);
+          auto count = ConstantInt::get(i32Ty, value);
+          // Insert `updateFunc` with argument (key, value) before
+          // `terminator`
+          CallInst::Create(updateFunc, {opcode, count}, "", terminator);
+        }
+        break;
+      case CounterMode::Inline:
+        // `__instrCounts__[key] += value`, a load, an add and a store each
+        for (auto &[key, value] : instrCount) {
+          incrementCounter(builder, countersType, counters, key,
+                           builder.getInt64(value));
+        }
+        break;
+      case CounterMode::Sampled:
+        sampled.push_back({&BB, table.size()});
+        appendOpcodeCounts(table, instrCount);
+        break;
       }
 
       instrCount.clear();
     }
 
-    // Insert a call to `__printInstrCount__` to print out dynamic instruction
-    // counts before main function returns
-    if (F.getName() == "main") {
-      auto printType = FunctionType::get(IntegerType::getVoidTy(CTX), false);
-      auto printFunc =
-          M->getOrInsertFunction("__printAndClearInstrCount__", printType);
-      auto mainRet = F.back().getTerminator();
-      CallInst::Create(printFunc, "", mainRet);
+    if (mode == CounterMode::Sampled) {
+      insertSampling(F, table, sampled);
     }
 
+    // No print call is inserted, the runtime prints the counts once when the
+    // program exits, be it through a return from `main` or `exit()`
+
     // Since we inserted some instructions, conservatively tell `opt`
     // that nothing is preserved.
     // If you know what you're doing, a better idea would be:
@@ -68,6 +137,114 @@ struct CountDynamicInstrPass : public PassInfoMixin<CountDynamicInstrPass> {
     // `analyses.abandon(...); ...`
     return PreservedAnalyses::none();
   }
+
+  /// Make every block in `sampled` decrement the `__instrCountdown__` of the
+  /// module, and call `__sampleInstrCounts__` with its entry of `table` when
+  /// it expires
+  auto insertSampling(
+      Function &F, ArrayRef<uint32_t> table,
+      ArrayRef<std::pair<BasicBlock *, unsigned>> sampled) const -> void {
+    auto M = F.getParent();
+    auto &CTX = M->getContext();
+
+    auto tableInit = ConstantDataArray::get(CTX, table);
+    auto tableVar = new GlobalVariable(
+        *M, tableInit->getType(), true, GlobalValue::PrivateLinkage,
+        tableInit, "__sampleTable__." + F.getName());
+
+    auto builder = IRBuilder<>(CTX);
+    auto sampleType = FunctionType::get(
+        builder.getInt64Ty(),
+        {builder.getInt32Ty()->getPointerTo(), builder.getInt64Ty()}, false);
+    auto sampleFunc =
+        M->getOrInsertFunction("__sampleInstrCounts__", sampleType);
+
+    for (auto [BB, offset] : sampled) {
+      auto entry = ConstantExpr::getInBoundsGetElementPtr(
+          tableInit->getType(), tableVar,
+          ArrayRef<Constant *>{builder.getInt64(0), builder.getInt64(offset)});
+      insertSampleCall(BB->getTerminator(), "__instrCountdown__", sampleFunc,
+                       {entry, builder.getInt64(period)});
+    }
+  }
+
+  CounterMode mode;
+  /// Average number of blocks between samples
+  uint64_t period;
+};
+
+/// Module pass incrementing a single counter per basic block, selected by
+/// `cdi<block>`.
+///
+/// Blocks of all functions are numbered in layout order and counted in a
+/// module-level array. A global constructor registers the array with the
+/// runtime, together with the static opcode counts of each block, and the
+/// runtime multiplies them by the block counts at exit.
+struct CountBlocksPass : public PassInfoMixin<CountBlocksPass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    auto &CTX = M.getContext();
+
+    // Terminators to count before, collected first so that the constructor
+    // is not instrumented
+    std::vector<Instruction *> terminators;
+    // Static opcode counts of every block, as `number of opcodes, opcode,
+    // count, opcode, count, ...` per block
+    std::vector<uint32_t> table;
+    std::map<unsigned, int> instrCount;
+    for (auto &F : M) {
+      for (auto &BB : F) {
+        for (auto &I : BB) {
+          mapInsertOrIncrement(instrCount, I.getOpcode(), 1);
+        }
+        terminators.push_back(BB.getTerminator());
+        appendOpcodeCounts(table, instrCount);
+        instrCount.clear();
+      }
+    }
+    if (terminators.empty()) {
+      return PreservedAnalyses::all();
+    }
+
+    auto builder = IRBuilder<>(CTX);
+    auto countersType =
+        ArrayType::get(builder.getInt64Ty(), terminators.size());
+    auto counters = new GlobalVariable(
+        M, countersType, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(countersType), "__blockCounts__");
+    for (unsigned block = 0; block < terminators.size(); block++) {
+      builder.SetInsertPoint(terminators[block]);
+      incrementCounter(builder, countersType, counters, block,
+                       builder.getInt64(1));
+    }
+
+    // Constructor handing the counters and the table to the runtime once
+    auto tableInit = ConstantDataArray::get(CTX, table);
+    auto tableVar = new GlobalVariable(M, tableInit->getType(), true,
+                                       GlobalValue::PrivateLinkage, tableInit,
+                                       "__blockTable__");
+
+    auto registerType = FunctionType::get(
+        builder.getVoidTy(),
+        {builder.getInt64Ty()->getPointerTo(),
+         builder.getInt32Ty()->getPointerTo(), builder.getInt32Ty()},
+        false);
+    auto registerFunc =
+        M.getOrInsertFunction("__registerBlockCounts__", registerType);
+    auto ctor = Function::Create(FunctionType::get(builder.getVoidTy(), false),
+                                 GlobalValue::InternalLinkage,
+                                 "__registerBlockCounts__.ctor", M);
+    builder.SetInsertPoint(BasicBlock::Create(CTX, "", ctor));
+    builder.CreateCall(
+        registerFunc,
+        {builder.CreateConstInBoundsGEP2_64(countersType, counters, 0, 0),
+         builder.CreateConstInBoundsGEP2_64(tableInit->getType(), tableVar, 0,
+                                            0),
+         builder.getInt32(terminators.size())});
+    builder.CreateRetVoid();
+    appendToGlobalCtors(M, ctor, 0);
+
+    return PreservedAnalyses::none();
+  }
 };
 } // namespace
 
@@ -78,8 +255,21 @@ llvmGetPassPluginInfo() {
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == ARGUMENT_NAME) {
-                    FPM.addPass(CountDynamicInstrPass());
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && !params->count("block")) {
+                    FPM.addPass(CountDynamicInstrPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && params->count("block")) {
+                    // One counter per block of the module
+                    MPM.addPass(CountBlocksPass());
                     return true;
                   } else {
                     return false;
@@ -1,8 +1,14 @@
-#include <map>
+#include <array>
+#include <string>
+#include <vector>
 
 #include "HelperFunctions.h"
+#include "llvm/IR/Instruction.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 
 using namespace llvm;
 
@@ -10,36 +16,138 @@ static auto PASS_NAME = "CountStaticInstrPass";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "csi";
 
+/// Instruction count of every opcode, indexed by opcode
+using OpcodeCounts = std::array<uint64_t, Instruction::OtherOpsEnd>;
+
+/// Add the instructions of `F` to `counts`
+static auto countOpcodes(const Function &F, OpcodeCounts &counts) -> void {
+  // Iterate over all basic blocks in function
+  for (auto &BB : F) {
+    // Iterate over all instructions in basic block
+    for (auto &I : BB) {
+      // Opcodes are small consecutive integers, so they index an array
+      // directly, no lookup needed
+      counts[I.getOpcode()] += 1;
+    }
+  }
+}
+
+/// Print one line `name\tcount` per opcode present, in opcode order
+static auto printCounts(const OpcodeCounts &counts, raw_ostream &OS) -> void {
+  for (unsigned opcode = 0; opcode < counts.size(); opcode++) {
+    if (counts[opcode] != 0) {
+      OS << Instruction::getOpcodeName(opcode) << "\t" << counts[opcode]
+         << "\n";
+    }
+  }
+}
+
 namespace {
 struct CountStaticInstrPass : public PassInfoMixin<CountStaticInstrPass> {
   PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-    // Map for storing instruction count
-    std::map<const char *, int> InstrCount;
-
-    // Iterate over all basic blocks in function
-    for (auto &BB : F) {
-      // Iterate over all instructions in basic block
-      for (auto &I : BB) {
-        // Note that `getOpcodeName` returns const char *, a fixed pointer.
-        // As long as the instruction have the same opcode name, the returned
-        // pointer will be the same.
-        // That's why you can use it as the key for the map.
-        auto InstrName = I.getOpcodeName();
-
-        // If intruction is not previously seen, add it to InstrCount map
-        // Otherwise increment count
-        mapInsertOrIncrement(InstrCount, InstrName, 1);
+    auto counts = OpcodeCounts();
+    countOpcodes(F, counts);
+    printCounts(counts, errs());
+
+    // Nothing is changed, all previous analyses are preserved
+    return PreservedAnalyses::all();
+  }
+};
+
+/// Count the instructions of the whole module and print a single report,
+/// instead of one per function.
+///
+/// With `parallel=N`, functions are counted in chunks by `N` worker threads
+/// (`parallel` alone uses every hardware thread), each into its own counts,
+/// which are added up at the end. `format=json` prints the report as a JSON
+/// object instead of text.
+struct CountModuleInstrPass : public PassInfoMixin<CountModuleInstrPass> {
+  CountModuleInstrPass(const PassParams &params)
+      : json(params.count("format") && params.at("format") == "json"),
+        parallel(params.count("parallel")),
+        threads(parsePositiveParam(params, "parallel", 0)) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    std::vector<const Function *> functions;
+    for (auto &F : M) {
+      if (!F.isDeclaration()) {
+        functions.push_back(&F);
       }
     }
 
-    // Iterate over map to print out instruction counts
-    for (auto &i : InstrCount) {
-      errs() << i.first << "\t" << i.second << "\n";
+    auto counts = OpcodeCounts();
+    if (parallel) {
+      countParallel(functions, counts);
+    } else {
+      for (auto F : functions) {
+        countOpcodes(*F, counts);
+      }
+    }
+
+    if (json) {
+      printJSON(functions.size(), counts, errs());
+    } else {
+      printCounts(counts, errs());
     }
 
-    // Nothing is changed, all previous analyses are preserved
     return PreservedAnalyses::all();
   }
+
+  /// Chunks of functions are small enough to balance the load of a module
+  /// with a few huge functions, and large enough that scheduling is cheap
+  /// for modules with hundreds of thousands of tiny ones
+  static constexpr size_t CHUNK_SIZE = 256;
+
+  auto countParallel(const std::vector<const Function *> &functions,
+                     OpcodeCounts &counts) -> void {
+    auto numChunks = (functions.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    // Instructions are only read, each chunk writes its own counts
+    auto partials = std::vector<OpcodeCounts>(numChunks);
+    auto pool = ThreadPool(hardware_concurrency(threads));
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+      pool.async([&functions, &partials, chunk] {
+        auto end = std::min(functions.size(), (chunk + 1) * CHUNK_SIZE);
+        for (auto i = chunk * CHUNK_SIZE; i < end; i++) {
+          countOpcodes(*functions[i], partials[chunk]);
+        }
+      });
+    }
+    pool.wait();
+
+    for (auto &partial : partials) {
+      for (size_t opcode = 0; opcode < counts.size(); opcode++) {
+        counts[opcode] += partial[opcode];
+      }
+    }
+  }
+
+  /// `{"functions": F, "instructions": I, "opcodes": {"name": count, ...}}`
+  static auto printJSON(size_t numFunctions, const OpcodeCounts &counts,
+                        raw_ostream &OS) -> void {
+    uint64_t total = 0;
+    for (auto count : counts) {
+      total += count;
+    }
+
+    auto J = json::OStream(OS, /*IndentSize=*/2);
+    J.object([&] {
+      J.attribute("functions", int64_t(numFunctions));
+      J.attribute("instructions", int64_t(total));
+      J.attributeObject("opcodes", [&] {
+        for (unsigned opcode = 0; opcode < counts.size(); opcode++) {
+          if (counts[opcode] != 0) {
+            J.attribute(Instruction::getOpcodeName(opcode),
+                        int64_t(counts[opcode]));
+          }
+        }
+      });
+    });
+    OS << "\n";
+  }
+
+  bool json;
+  bool parallel;
+  unsigned threads;
 };
 } // namespace
 
@@ -57,5 +165,17 @@ llvmGetPassPluginInfo() {
                     return false;
                   }
                 });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  // Any parameter selects the module-wide report
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && !params->empty()) {
+                    MPM.addPass(CountModuleInstrPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
           }};
-}
\ No newline at end of file
+}
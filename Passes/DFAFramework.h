@@ -1,8 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <queue>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "HelperFunctions.h"
+#include "InstrGraph.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -23,95 +45,1224 @@ using namespace llvm;
     /// Compose 2 lattice values into a new one
     /// Should be 1. idempotent 2. commutative 3. associative
     virtual auto operator^(const Info &other) const -> Info * = 0;
+
+    /// Only needed for caching results, see `AnalysisCache`. Equal values
+    /// must be saved as the same words.
+    auto save(FactWriter &writer, const ValueUniverse &universe) const
+        -> void;
+    auto load(FactReader &reader, const ValueUniverse &universe) -> bool;
+
+    /// Optional, compose another lattice value into this one without
+    /// making a copy. `a = a ^ b` is used if absent.
+    auto operator^=(const Info &other) -> Info &;
+
+    /// Optional, number of facts in the value, reported by solver stats
+    auto size() const -> size_t;
   };
 */
 
+template <class Info, class = void> struct HasMeetAssign : std::false_type {};
+
+template <class Info>
+struct HasMeetAssign<Info, std::void_t<decltype(std::declval<Info &>() ^=
+                                                std::declval<const Info &>())>>
+    : std::true_type {};
+
+template <class Info, class = void> struct HasSize : std::false_type {};
+
+template <class Info>
+struct HasSize<Info, std::void_t<decltype(std::declval<const Info &>().size())>>
+    : std::true_type {};
+
+/// Whether lattice values can copy themselves into a memory resource, with
+/// a constructor `Info(const Info &, std::pmr::memory_resource *)`
+template <class Info>
+using HasArenaCopy =
+    std::is_constructible<Info, const Info &, std::pmr::memory_resource *>;
+
+/// `a = a ^ b`, in place if the lattice supports it
+template <class Info> static auto meetInto(Info &a, const Info &b) -> void {
+  if constexpr (HasMeetAssign<Info>::value) {
+    a ^= b;
+  } else {
+    a = a ^ b;
+  }
+}
+
+/// Hash-consing table of the bit vectors of one `ValueUniverse`, see
+/// `BitVectorInfo`. Every vector has one bit per value of the universe.
+///
+/// Interned vectors are immutable and reference counted by the values
+/// holding them. Once unused they leave the table, and their memory is
+/// reused for the next vector, so the table only holds the distinct sets
+/// that are alive. Not thread safe, like the rest of a function's analysis.
+class BitVectorTable {
+public:
+  BitVectorTable(unsigned numBits) : words((numBits + 63) / 64) {}
+
+  auto numWords() const -> size_t { return words; }
+
+  /// Shared copy of `vector`, which has `numWords` words, with one more
+  /// reference. The empty set is always null.
+  auto intern(ArrayRef<uint64_t> vector) -> const uint64_t * {
+    assert(vector.size() == words && "Vector of another universe");
+    if (std::all_of(vector.begin(), vector.end(),
+                    [](uint64_t word) { return word == 0; })) {
+      return nullptr;
+    }
+    auto key = Key{vector, hash_value(vector)};
+    auto it = table.find_as(key);
+    if (it != table.end()) {
+      retain(*it);
+      return *it;
+    }
+
+    // Each vector is preceded by its hash and its reference count
+    uint64_t *node;
+    if (!freeList.empty()) {
+      node = freeList.back();
+      freeList.pop_back();
+    } else {
+      node = allocator.Allocate<uint64_t>(words + 2);
+    }
+    node[0] = size_t(key.hash);
+    node[1] = 1;
+    std::copy(vector.begin(), vector.end(), node + 2);
+    table.insert(node + 2);
+    return node + 2;
+  }
+
+  auto retain(const uint64_t *vector) -> void {
+    if (vector != nullptr) {
+      const_cast<uint64_t *>(vector)[-1] += 1;
+    }
+  }
+
+  auto release(const uint64_t *vector) -> void {
+    if (vector == nullptr) {
+      return;
+    }
+    auto node = const_cast<uint64_t *>(vector) - 2;
+    if (--node[1] == 0) {
+      table.erase(vector);
+      freeList.push_back(node);
+    }
+  }
+
+  /// Number of distinct non-empty vectors alive
+  auto size() const -> size_t { return table.size(); }
+
+private:
+  /// Contents of a vector to look up
+  struct Key {
+    ArrayRef<uint64_t> vector;
+    hash_code hash;
+  };
+
+  /// Interned vectors are unique, so they are compared by address, and
+  /// hashed without reading their contents again
+  struct VectorInfo : DenseMapInfo<const uint64_t *> {
+    static auto getHashValue(const uint64_t *vector) -> unsigned {
+      return unsigned(vector[-2]);
+    }
+    static auto getHashValue(const Key &key) -> unsigned {
+      return unsigned(size_t(key.hash));
+    }
+    static auto isEqual(const uint64_t *a, const uint64_t *b) -> bool {
+      return a == b;
+    }
+    static auto isEqual(const Key &key, const uint64_t *vector) -> bool {
+      return vector != getEmptyKey() && vector != getTombstoneKey() &&
+             vector[-2] == uint64_t(size_t(key.hash)) &&
+             std::equal(key.vector.begin(), key.vector.end(), vector);
+    }
+  };
+
+  size_t words;
+  DenseSet<const uint64_t *, VectorInfo> table;
+  std::vector<uint64_t *> freeList;
+  BumpPtrAllocator allocator;
+};
+
+/// Dense numbering of the values a set-based analysis reasons about.
+/// Built once per function and shared by every lattice value of the analysis,
+/// so that sets of values can be stored as bit vectors.
+class ValueUniverse {
+public:
+  /// Number instructions in the same order as `InstrGraph`, i.e. the
+  /// instruction printed as `n` has index `n - 1`
+  static auto instructions(Function &F) -> ValueUniverse {
+    auto universe = ValueUniverse();
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        universe.insert(&I);
+      }
+    }
+    return universe;
+  }
+
+  /// Number instructions first, followed by every other value used as an
+  /// operand (arguments, constants, labels, ...)
+  static auto operands(Function &F) -> ValueUniverse {
+    auto universe = instructions(F);
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        for (auto &op : I.operands()) {
+          universe.insert(op);
+        }
+      }
+    }
+    return universe;
+  }
+
+  /// Assign the next index to a value if it is not yet numbered
+  auto insert(Value *V) -> unsigned {
+    assert(!table && "Bit vectors over the universe already exist");
+    auto [it, inserted] = indices.insert({V, values.size()});
+    if (inserted) {
+      values.push_back(V);
+    }
+    return it->second;
+  }
+
+  auto indexOf(Value *V) const -> unsigned {
+    auto it = indices.find(V);
+    assert(it != indices.end() && "Value is not part of the universe");
+    return it->second;
+  }
+
+  auto operator[](unsigned index) const -> Value * { return values[index]; }
+
+  auto size() const -> unsigned { return values.size(); }
+
+  /// Interned bit vectors over this universe, created on first use, after
+  /// which no more values may be inserted
+  auto bitVectors() const -> BitVectorTable & {
+    if (!table) {
+      table = std::make_unique<BitVectorTable>(size());
+    }
+    return *table;
+  }
+
+private:
+  DenseMap<Value *, unsigned> indices;
+  std::vector<Value *> values;
+  mutable std::unique_ptr<BitVectorTable> table;
+};
+
+/// Little-endian stream of 32-bit words that lattice values are saved to,
+/// e.g. to cache analysis results on disk
+class FactWriter {
+public:
+  auto write(uint32_t word) -> void {
+    char bytes[4];
+    support::endian::write32le(bytes, word);
+    data.append(bytes, 4);
+  }
+
+  auto str() const -> StringRef { return data; }
+
+private:
+  std::string data;
+};
+
+/// Reads back what `FactWriter` wrote. The data may be memory mapped and need
+/// not be aligned.
+class FactReader {
+public:
+  FactReader(StringRef data) : data(data) {}
+
+  /// Return false if the data is exhausted
+  auto read(uint32_t &word) -> bool {
+    if (data.size() < 4) {
+      return false;
+    }
+    word = support::endian::read32le(data.data());
+    data = data.drop_front(4);
+    return true;
+  }
+
+  auto atEnd() const -> bool { return data.empty(); }
+
+private:
+  StringRef data;
+};
+
+/// Reusable lattice value for analyses whose facts are sets of values.
+/// The set is a bit vector over a `ValueUniverse`, so union, intersection
+/// and equality work a 64-bit word at a time. The loops are kept simple
+/// enough for the compiler to vectorize them.
+///
+/// Values are hash-consed: the words of a set are stored once per universe
+/// in its `BitVectorTable`, and every value holding the same set shares
+/// them. Copies are a pointer copy, equality of interned values is a
+/// pointer comparison, a union with the same set or into the empty set
+/// costs nothing, and the values of a function only take as much memory as
+/// its distinct sets. A value being modified gets a private draft of its
+/// words instead, so intermediate results of a transfer function are not
+/// interned. The solver calls `intern` on the values it keeps.
+///
+/// `Derived` is the concrete lattice class (CRTP), which still defines its
+/// own meet operator `^` and `print` method.
+template <class Derived> class BitVectorInfo {
+public:
+  BitVectorInfo() {}
+  BitVectorInfo(const ValueUniverse *universe) : universe(universe) {}
+
+  /// Copies share interned words, and copy drafts
+  BitVectorInfo(const BitVectorInfo &other)
+      : universe(other.universe), draft(other.draft) {
+    if (draft.empty()) {
+      words = other.words;
+      retain(words);
+    }
+  }
+
+  BitVectorInfo(BitVectorInfo &&other)
+      : universe(other.universe), words(other.words),
+        draft(std::move(other.draft)) {
+    other.words = nullptr;
+    other.draft.clear();
+  }
+
+  auto operator=(const BitVectorInfo &other) -> BitVectorInfo & {
+    if (this != &other) {
+      auto shared = other.draft.empty() ? other.words : nullptr;
+      other.retain(shared);
+      release(words);
+      universe = other.universe;
+      words = shared;
+      draft = other.draft;
+    }
+    return *this;
+  }
+
+  auto operator=(BitVectorInfo &&other) -> BitVectorInfo & {
+    if (this != &other) {
+      release(words);
+      universe = other.universe;
+      words = other.words;
+      draft = std::move(other.draft);
+      other.words = nullptr;
+      other.draft.clear();
+    }
+    return *this;
+  }
+
+  ~BitVectorInfo() { release(words); }
+
+  /// Replace a draft by the shared words of the same set
+  auto intern() -> void {
+    if (!draft.empty()) {
+      words = universe->bitVectors().intern(draft);
+      draft = std::vector<uint64_t>();
+    }
+  }
+
+  /// Return true if the value was not yet in the set
+  auto insert(Value *V) -> bool { return set(universe->indexOf(V)); }
+
+  auto erase(Value *V) -> void { reset(universe->indexOf(V)); }
+
+  auto contains(Value *V) const -> bool { return test(universe->indexOf(V)); }
+
+  /// Return true if the bit was not set before
+  auto set(unsigned index) -> bool {
+    // Interned words are only copied if the bit is missing
+    if (draft.empty() && test(index)) {
+      return false;
+    }
+    auto &word = edit()[index / 64];
+    auto bit = uint64_t(1) << (index % 64);
+    auto changed = (word & bit) == 0;
+    word |= bit;
+    return changed;
+  }
+
+  auto reset(unsigned index) -> void {
+    if (!draft.empty() || test(index)) {
+      edit()[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+  }
+
+  auto test(unsigned index) const -> bool {
+    auto data = read();
+    return data != nullptr && index / 64 < numWords() &&
+           (data[index / 64] >> (index % 64) & 1);
+  }
+
+  /// Call `f` with the index of every element, in increasing order
+  template <typename F> auto forEachIndex(F f) const -> void {
+    auto data = read();
+    for (size_t w = 0; data != nullptr && w < numWords(); w++) {
+      for (auto bits = data[w]; bits != 0; bits &= bits - 1) {
+        f(unsigned(w * 64 + countTrailingZeros(bits)));
+      }
+    }
+  }
+
+  /// Call `f` with every element, in universe order
+  template <typename F> auto forEach(F f) const -> void {
+    forEachIndex([&](unsigned index) { f((*universe)[index]); });
+  }
+
+  /// Word-wise union
+  auto operator|=(const BitVectorInfo &other) -> Derived & {
+    unionWith(other);
+    return static_cast<Derived &>(*this);
+  }
+
+  /// Word-wise union that reports whether any bit was added, optionally
+  /// leaving out the element at index `except`
+  auto unionWith(const BitVectorInfo &other, unsigned except = ~0u) -> bool {
+    auto src = other.read();
+    if (src == nullptr || (draft.empty() && words == src)) {
+      return false;
+    }
+    adopt(other);
+
+    // Only draft a new set if a bit is actually added. If this set is
+    // contained in the other one, e.g. the previous input of a node
+    // and the new output of its only predecessor, the union is the other
+    // set and its words are shared instead.
+    auto n = numWords();
+    auto dst = read();
+    auto keep = [&](size_t i) {
+      return i == except / 64 ? ~(uint64_t(1) << (except % 64)) : ~uint64_t(0);
+    };
+    uint64_t added = 0;
+    uint64_t extra = 0;
+    for (size_t i = 0; i < n; i++) {
+      auto word = dst != nullptr ? dst[i] : 0;
+      added |= src[i] & keep(i) & ~word;
+      extra |= word & ~src[i];
+    }
+    if (added == 0) {
+      return false;
+    }
+    if (extra == 0 && !other.test(except)) {
+      *this = other;
+      return true;
+    }
+    auto out = edit();
+    for (size_t i = 0; i < n; i++) {
+      out[i] |= src[i] & keep(i);
+    }
+    return true;
+  }
+
+  /// Word-wise intersection
+  auto operator&=(const BitVectorInfo &other) -> Derived & {
+    auto src = other.read();
+    adopt(other);
+    if (src == nullptr) {
+      *this = BitVectorInfo(universe);
+    } else if (read() != nullptr && !(draft.empty() && words == src)) {
+      auto out = edit();
+      for (size_t i = 0; i < numWords(); i++) {
+        out[i] &= src[i];
+      }
+    }
+    return static_cast<Derived &>(*this);
+  }
+
+  auto operator|(const BitVectorInfo &other) const -> Derived {
+    auto result = static_cast<const Derived &>(*this);
+    result |= other;
+    return result;
+  }
+
+  auto operator&(const BitVectorInfo &other) const -> Derived {
+    auto result = static_cast<const Derived &>(*this);
+    result &= other;
+    return result;
+  }
+
+  /// Interned sets are equal if they share their words, drafts are compared
+  /// word by word
+  auto operator==(const BitVectorInfo &other) const -> bool {
+    if (draft.empty() && other.draft.empty()) {
+      return words == other.words;
+    }
+    auto a = read();
+    auto b = other.read();
+    for (size_t i = 0; i < std::max(numWords(), other.numWords()); i++) {
+      if ((a != nullptr ? a[i] : 0) != (b != nullptr ? b[i] : 0)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Number of elements
+  auto size() const -> size_t {
+    auto data = read();
+    size_t count = 0;
+    for (size_t w = 0; data != nullptr && w < numWords(); w++) {
+      count += countPopulation(data[w]);
+    }
+    return count;
+  }
+
+  /// Save the raw words, `universe` only matters to other lattices
+  auto save(FactWriter &writer, const ValueUniverse &) const -> void {
+    auto data = read();
+    writer.write(numWords());
+    for (size_t w = 0; w < numWords(); w++) {
+      auto word = data != nullptr ? data[w] : 0;
+      writer.write(uint32_t(word));
+      writer.write(uint32_t(word >> 32));
+    }
+  }
+
+  /// Load words saved by `save` into a value of the same universe, e.g. a
+  /// copy of `top`. Return false if the word count does not match.
+  auto load(FactReader &reader, const ValueUniverse &) -> bool {
+    uint32_t size, low, high;
+    if (!reader.read(size) || size != numWords()) {
+      return false;
+    }
+    auto out = edit();
+    for (size_t w = 0; w < size; w++) {
+      if (!reader.read(low) || !reader.read(high)) {
+        return false;
+      }
+      out[w] = uint64_t(high) << 32 | low;
+    }
+    intern();
+    return true;
+  }
+
+  const ValueUniverse *universe = nullptr;
+
+private:
+  auto numWords() const -> size_t {
+    return universe != nullptr ? universe->bitVectors().numWords() : 0;
+  }
+
+  /// Current words, null for the empty set
+  auto read() const -> const uint64_t * {
+    return draft.empty() ? words : draft.data();
+  }
+
+  /// Private copy of the words to modify
+  auto edit() -> uint64_t * {
+    if (draft.empty()) {
+      auto n = numWords();
+      draft = words != nullptr ? std::vector<uint64_t>(words, words + n)
+                               : std::vector<uint64_t>(n);
+      release(words);
+      words = nullptr;
+    }
+    return draft.data();
+  }
+
+  auto retain(const uint64_t *vector) const -> void {
+    if (vector != nullptr) {
+      universe->bitVectors().retain(vector);
+    }
+  }
+
+  auto release(const uint64_t *vector) const -> void {
+    if (vector != nullptr) {
+      universe->bitVectors().release(vector);
+    }
+  }
+
+  /// Default constructed values pick up the universe of the other operand
+  auto adopt(const BitVectorInfo &other) -> void {
+    if (universe == nullptr) {
+      universe = other.universe;
+    }
+  }
+
+  /// Interned words of the set, null if empty
+  const uint64_t *words = nullptr;
+  /// Words being modified, empty if there is no draft. `words` is null
+  /// while there is a draft.
+  std::vector<uint64_t> draft;
+};
+
+/// Intern a lattice value kept by the solver, if the lattice supports it
+template <class Info> static auto internValue(Info &value) -> void {
+  if constexpr (std::is_base_of_v<BitVectorInfo<Info>, Info>) {
+    value.intern();
+  }
+}
+
+/// Memory resource for the containers inside lattice values, owned by the
+/// analysis (see `HasArenaCopy`). Blocks are carved out of a bump allocator
+/// and recycled through one free list per size class, so that once warmed
+/// up, solving makes no calls to the global heap, and everything is freed
+/// at once with the analysis. Not thread safe, like the rest of a function's
+/// analysis.
+class LatticeArena : public std::pmr::memory_resource {
+private:
+  /// Blocks are rounded up to a multiple of `GRANULE` bytes. Larger or more
+  /// aligned blocks than container nodes are not recycled.
+  static constexpr size_t GRANULE = 16;
+  static constexpr size_t MAX_RECYCLED = 512;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  static auto recycled(size_t bytes, size_t alignment) -> bool {
+    return bytes <= MAX_RECYCLED && alignment <= GRANULE;
+  }
+
+  auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+    if (!recycled(bytes, alignment)) {
+      return allocator.Allocate(bytes, Align(alignment));
+    }
+    auto sizeClass = std::max<size_t>((bytes + GRANULE - 1) / GRANULE, 1);
+    auto &head = freeLists[sizeClass];
+    if (head != nullptr) {
+      auto block = head;
+      head = block->next;
+      return block;
+    }
+    return allocator.Allocate(sizeClass * GRANULE, Align(GRANULE));
+  }
+
+  auto do_deallocate(void *pointer, size_t bytes, size_t alignment)
+      -> void override {
+    if (recycled(bytes, alignment)) {
+      auto sizeClass = std::max<size_t>((bytes + GRANULE - 1) / GRANULE, 1);
+      auto block = static_cast<FreeBlock *>(pointer);
+      block->next = freeLists[sizeClass];
+      freeLists[sizeClass] = block;
+    }
+  }
+
+  auto do_is_equal(const std::pmr::memory_resource &other) const noexcept
+      -> bool override {
+    return this == &other;
+  }
+
+  BumpPtrAllocator allocator;
+  std::array<FreeBlock *, MAX_RECYCLED / GRANULE + 1> freeLists = {};
+};
+
+/// Worklist that always yields the pending node with the smallest priority.
+/// Nodes are identified by their priority, i.e. their position in the
+/// visiting order, and are queued at most once at a time.
+class PriorityWorklist {
+public:
+  PriorityWorklist(unsigned size) : queued(size) {}
+
+  auto push(unsigned node) -> void {
+    if (!queued[node]) {
+      queued[node] = true;
+      heap.push(node);
+    }
+  }
+
+  auto pop() -> unsigned {
+    auto node = heap.top();
+    heap.pop();
+    queued[node] = false;
+    return node;
+  }
+
+  auto empty() const -> bool { return heap.empty(); }
+
+private:
+  std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>>
+      heap;
+  std::vector<bool> queued;
+};
+
 enum AnalysisDirection {
   Forward,
   Backward,
 };
 
+/// Granularity of the worklist solver
+enum SolverMode {
+  /// One worklist entry and one `in` / `out` pair per instruction
+  PerInstruction,
+  /// One worklist entry and one `in` / `out` pair per basic block.
+  /// Instruction facts are recovered on demand by replaying the transfer
+  /// function through the block.
+  PerBlock,
+  /// Facts of a bit-vector lattice are propagated one at a time, from the
+  /// instructions that generate them (found through the operand lists, i.e.
+  /// SSA def-use edges) across block boundaries, stopping where they are
+  /// killed. Only block entry facts are stored, instruction facts are
+  /// recovered on demand like in `PerBlock`. Needs `genKill`.
+  Sparse,
+};
+
+/// Solver mode selected by the `block` / `sparse` pass parameters
+static inline auto parseSolverMode(const PassParams &params) -> SolverMode {
+  if (params.count("sparse")) {
+    return SolverMode::Sparse;
+  } else if (params.count("block")) {
+    return SolverMode::PerBlock;
+  } else {
+    return SolverMode::PerInstruction;
+  }
+}
+
+/// Counters and timers of one solver run, collected only if enabled with
+/// `DataFlowAnalysis::enableStats` (the `stats` pass parameter). Solvers are
+/// instantiated with and without them, so that the counting code is
+/// compiled out of the solver used otherwise.
+struct SolverStats {
+  /// Nodes taken off the worklist: instructions, blocks, or block / fact
+  /// pairs for the sparse solver
+  uint64_t iterations = 0;
+  /// Applications of the meet operator
+  uint64_t meets = 0;
+  /// Transfer function calls by the solver, and by `expand` when recovering
+  /// instruction facts from block facts
+  uint64_t transfers = 0;
+  uint64_t replays = 0;
+  /// Node outputs that changed and queued their successors again (facts
+  /// that entered a block, for the sparse solver)
+  uint64_t changes = 0;
+  /// Largest lattice value stored by the solver (per instruction or per
+  /// block, depending on the mode), if the lattice has a `size` method
+  uint64_t maxLatticeSize = 0;
+  /// Seconds spent setting up the solver, solving, and recovering
+  /// instruction facts
+  double initSeconds = 0;
+  double solveSeconds = 0;
+  double expandSeconds = 0;
+
+  /// Print as one line of JSON
+  auto print(raw_ostream &OS, StringRef function, StringRef mode) const
+      -> void {
+    auto J = json::OStream(OS);
+    J.object([&] {
+      J.attribute("function", function);
+      J.attribute("mode", mode);
+      J.attribute("iterations", int64_t(iterations));
+      J.attribute("meets", int64_t(meets));
+      J.attribute("transfers", int64_t(transfers));
+      J.attribute("replays", int64_t(replays));
+      J.attribute("changes", int64_t(changes));
+      J.attribute("max_lattice_size", int64_t(maxLatticeSize));
+      J.attribute("init_seconds", initSeconds);
+      J.attribute("solve_seconds", solveSeconds);
+      J.attribute("expand_seconds", expandSeconds);
+    });
+    OS << "\n";
+  }
+};
+
 template <class Info, AnalysisDirection Direction> class DataFlowAnalysis {
 public:
-  DataFlowAnalysis(Info lattice_top, Function &F) : func(F) {
-    for (auto &BB : F) {
-      for (auto &I : BB) {
-        in[&I] = lattice_top;
-        out[&I] = lattice_top;
+  /// Analyze `F` with a private instruction graph
+  DataFlowAnalysis(Info lattice_top, Function &F,
+                   SolverMode mode = SolverMode::PerInstruction)
+      : ownedGraph(std::make_unique<InstrGraph>(F)), graph(*ownedGraph),
+        top(arenaCopy(lattice_top)), func(F), mode(mode) {
+    computeOrder();
+  }
+
+  /// Analyze the function of `G`, typically obtained from
+  /// `InstrGraphAnalysis` so that several analyses share it
+  DataFlowAnalysis(Info lattice_top, const InstrGraph &G,
+                   SolverMode mode = SolverMode::PerInstruction)
+      : graph(G), top(arenaCopy(lattice_top)), func(G.getFunction()),
+        mode(mode) {
+    computeOrder();
+  }
+
+  virtual ~DataFlowAnalysis() {}
+
+  auto run() -> void {
+    if (statsEnabled) {
+      solve<true>();
+    } else {
+      solve<false>();
+    }
+  }
+
+  /// Collect `SolverStats` from now on, see `printStats`
+  auto enableStats() -> void { statsEnabled = true; }
+
+  /// Lattice value flowing into an instruction, in analysis direction
+  auto getIn(Instruction *I) -> const Info & {
+    expand();
+    return in[graph.indexOf(I)];
+  }
+
+  /// Lattice value flowing out of an instruction, in analysis direction
+  auto getOut(Instruction *I) -> const Info & {
+    expand();
+    return out[graph.indexOf(I)];
+  }
+
+  /// Send `print` and `printStats` output to `OS` instead of stderr,
+  /// e.g. to buffer it when analyzing several functions concurrently
+  auto setOutput(raw_ostream &OS) -> void { os = &OS; }
+
+  virtual auto print() -> void {
+    *os << "Function: " << func.getName() << "\n";
+
+    expand();
+    auto &map = graph.numbering();
+    // `os` is usually unbuffered stderr, which would make a system call per
+    // printed number. Each instruction is formatted into a buffer first.
+    auto text = std::string();
+    auto buffer = raw_string_ostream(text);
+    for (unsigned n = 0; n < graph.size(); n++) {
+      buffer << n + 1 << "\t:";
+      graph[n]->print(buffer);
+      buffer << "\n"
+             << "in"
+             << "\t: ";
+      in[n].print(buffer, map);
+      buffer << "\n"
+             << "out"
+             << "\t: ";
+      out[n].print(buffer, map);
+      buffer << "\n";
+      *os << buffer.str();
+      text.clear();
+    }
+
+    *os << "\n";
+  }
+
+  /// Save the solution compactly, as the facts entering each block (in
+  /// analysis direction). Everything else is recovered from them like after
+  /// `runPerBlock`.
+  auto saveFacts(FactWriter &writer, const ValueUniverse &universe) -> void {
+    expand();
+    writer.write(graph.numBlocks());
+    for (unsigned b = 0; b < graph.numBlocks(); b++) {
+      in[entryOf(b)].save(writer, universe);
+    }
+  }
+
+  /// Use a solution saved by `saveFacts` instead of calling `run`.
+  /// Return false if it does not fit this function.
+  auto loadFacts(FactReader &reader, const ValueUniverse &universe) -> bool {
+    uint32_t size;
+    if (!reader.read(size) || size != graph.numBlocks()) {
+      return false;
+    }
+    fillTop(blockIn, graph.numBlocks());
+    for (auto &value : blockIn) {
+      if (!value.load(reader, universe)) {
+        return false;
       }
     }
+    expanded = false;
+    return true;
+  }
 
-    auto entry = Direction == AnalysisDirection::Forward
-                     ? &F.front().front()
-                     : F.back().getTerminator();
-    worklist.insert(entry);
+  /// Print the stats collected so far as one line of JSON
+  auto printStats() -> void {
+    static const char *modeNames[] = {"instruction", "block", "sparse"};
+    stats.print(*os, func.getName(), modeNames[mode]);
   }
 
-  virtual ~DataFlowAnalysis() {}
+  /// Transfer function returning a new lattice value.
+  /// Analyses override either this one or `transferInPlace`.
+  virtual auto transferFunction(Instruction *, Info) -> Info {
+    llvm_unreachable("override transferFunction or transferInPlace");
+  }
 
-  auto getPrevNextSetFunc() {
-    switch (Direction) {
-    case AnalysisDirection::Forward:
-      return std::pair(getInstrPred, getInstrSucc);
-    case AnalysisDirection::Backward:
-      return std::pair(getInstrSucc, getInstrPred);
+  /// In-place transfer function: update `output` to the output of `instr`
+  /// given `input`, and return true if `output` changed. Returning true
+  /// without an actual change is allowed but causes extra iterations.
+  ///
+  /// `output` holds the value computed the last time `instr` was visited
+  /// (or `top`), from an input no larger than the current one. Since
+  /// transfer functions are monotone, most analyses can merge `input` into
+  /// `output` and apply their effects on top of it, without copying either.
+  ///
+  /// The default falls back to `transferFunction`.
+  virtual auto transferInPlace(Instruction *instr, const Info &input,
+                               Info &output) -> bool {
+    auto result = transferFunction(instr, input);
+    if (result == output) {
+      return false;
     }
+    output = std::move(result);
+    return true;
   }
 
-  auto run() -> void {
-    while (!worklist.empty()) {
-      auto [prevInstrs, nextInstrs] = getPrevNextSetFunc();
+  /// Gen / kill form of the transfer function, only used by the sparse
+  /// solver: `output = (input - kill) + gen`, with facts given as indices
+  /// into the universe of a bit-vector lattice whose `top` is the empty set.
+  /// Must agree with the transfer function.
+  virtual auto genKill(Instruction *, SmallVectorImpl<unsigned> &,
+                       SmallVectorImpl<unsigned> &) -> void {
+    report_fatal_error("the sparse solver needs genKill");
+  }
+
+protected:
+  auto getTop() const -> const Info & { return top; }
+
+private:
+  /// Compute the visiting order once per function: reverse postorder of the
+  /// CFG for forward analyses, postorder for backward ones. The position of
+  /// a node in this order is its priority in the worklist.
+  auto computeOrder() -> void {
+    auto rpo = graph.reversePostOrder();
+    blockOrder.assign(rpo.begin(), rpo.end());
+    if (Direction == AnalysisDirection::Backward) {
+      std::reverse(blockOrder.begin(), blockOrder.end());
+    }
+
+    blockPriority.resize(graph.numBlocks());
+    priority.resize(graph.size());
+    for (unsigned p = 0; p < blockOrder.size(); p++) {
+      blockPriority[blockOrder[p]] = p;
+      forEachInstr(blockOrder[p], [&](unsigned n) {
+        priority[n] = order.size();
+        order.push_back(n);
+      });
+    }
+  }
+
+  /// Predecessors in analysis direction
+  auto prevs(unsigned n) -> ArrayRef<unsigned> {
+    return Direction == AnalysisDirection::Forward ? graph.preds(n)
+                                                   : graph.succs(n);
+  }
+
+  /// Successors in analysis direction
+  auto nexts(unsigned n) -> ArrayRef<unsigned> {
+    return Direction == AnalysisDirection::Forward ? graph.succs(n)
+                                                   : graph.preds(n);
+  }
+
+  /// Predecessor blocks in analysis direction
+  auto prevBlocks(unsigned b) -> ArrayRef<unsigned> {
+    return Direction == AnalysisDirection::Forward ? graph.blockPreds(b)
+                                                   : graph.blockSuccs(b);
+  }
+
+  /// Successor blocks in analysis direction
+  auto nextBlocks(unsigned b) -> ArrayRef<unsigned> {
+    return Direction == AnalysisDirection::Forward ? graph.blockSuccs(b)
+                                                   : graph.blockPreds(b);
+  }
+
+  /// Visit instructions of a block in analysis direction
+  template <typename F> auto forEachInstr(unsigned b, F f) -> void {
+    if (Direction == AnalysisDirection::Forward) {
+      for (auto n = graph.begin(b); n < graph.end(b); n++) {
+        f(n);
+      }
+    } else {
+      for (auto n = graph.end(b); n > graph.begin(b); n--) {
+        f(n - 1);
+      }
+    }
+  }
+
+  /// Copy of `value` allocated from the arena of this analysis, if the
+  /// lattice supports it
+  auto arenaCopy(const Info &value) -> Info {
+    if constexpr (HasArenaCopy<Info>::value) {
+      return Info(value, &arena);
+    } else {
+      return value;
+    }
+  }
+
+  /// Replace `values` by `size` copies of `top`, allocated from the arena
+  auto fillTop(std::vector<Info> &values, size_t size) -> void {
+    values.clear();
+    values.reserve(size);
+    for (size_t i = 0; i < size; i++) {
+      values.push_back(arenaCopy(top));
+    }
+  }
+
+  /// First instruction of a block in analysis direction
+  auto entryOf(unsigned b) -> unsigned {
+    return Direction == AnalysisDirection::Forward ? graph.begin(b)
+                                                   : graph.end(b) - 1;
+  }
+
+  using Clock = std::chrono::steady_clock;
+
+  /// Increment a stats counter, nothing when not collecting stats
+  template <bool Stats> static auto count(uint64_t &counter) -> void {
+    if constexpr (Stats) {
+      counter += 1;
+    }
+  }
+
+  /// Start of a timed phase, only read when collecting stats
+  template <bool Stats> static auto startPhase() -> Clock::time_point {
+    if constexpr (Stats) {
+      return Clock::now();
+    } else {
+      return {};
+    }
+  }
+
+  /// Add the time since `start` to `seconds` and start the next phase
+  template <bool Stats>
+  static auto endPhase(double &seconds, Clock::time_point &start) -> void {
+    if constexpr (Stats) {
+      auto now = Clock::now();
+      seconds += std::chrono::duration<double>(now - start).count();
+      start = now;
+    }
+  }
+
+  template <bool Stats> auto solve() -> void {
+    switch (mode) {
+    case SolverMode::PerInstruction:
+      runPerInstruction<Stats>();
+      break;
+    case SolverMode::PerBlock:
+      runPerBlock<Stats>();
+      break;
+    case SolverMode::Sparse:
+      runSparse<Stats>();
+      break;
+    }
+
+    if constexpr (Stats && HasSize<Info>::value) {
+      for (auto *values : {&in, &out, &blockIn, &blockOut}) {
+        for (auto &value : *values) {
+          stats.maxLatticeSize =
+              std::max<uint64_t>(stats.maxLatticeSize, value.size());
+        }
+      }
+    }
+  }
+
+  /// Apply the transfer function on behalf of the solver
+  template <bool Stats>
+  auto transfer(unsigned n, const Info &input, Info &output) -> bool {
+    count<Stats>(stats.transfers);
+    return transferInPlace(graph[n], input, output);
+  }
+
+  template <bool Stats> auto runPerInstruction() -> void {
+    // Every node is visited at least once, otherwise facts are lost whenever
+    // the transfer function of the first node leaves `top` unchanged
+    auto start = startPhase<Stats>();
+    auto worklist = PriorityWorklist(graph.size());
+    fillTop(in, graph.size());
+    fillTop(out, graph.size());
+    for (unsigned p = 0; p < graph.size(); p++) {
+      worklist.push(p);
+    }
+    endPhase<Stats>(stats.initSeconds, start);
 
-      // Select and remove a node (instruction) from the work list
-      auto node = set::pop(worklist);
+    while (!worklist.empty()) {
+      // Select and remove the node (instruction) that comes first in the
+      // visiting order
+      auto node = order[worklist.pop()];
+      count<Stats>(stats.iterations);
 
       // Apply `meet` operators to output values of all predecessors (successors
       // for backward analyses)
-      for (auto &prev : prevInstrs(*node)) {
-        in[node] = in[node] ^ out[prev];
+      for (auto prev : prevs(node)) {
+        meetInto(in[node], out[prev]);
+        count<Stats>(stats.meets);
+      }
+      internValue(in[node]);
+
+      // Apply transfer function, add to worklist if output changed
+      if (transfer<Stats>(node, in[node], out[node])) {
+        internValue(out[node]);
+        count<Stats>(stats.changes);
+        for (auto next : nexts(node)) {
+          worklist.push(priority[next]);
+        }
+      }
+    }
+    endPhase<Stats>(stats.solveSeconds, start);
+
+    expanded = true;
+  }
+
+  /// Same worklist algorithm as `runPerInstruction`, but on basic blocks.
+  /// The transfer function of a block is the composition of the transfer
+  /// functions of its instructions.
+  template <bool Stats> auto runPerBlock() -> void {
+    auto start = startPhase<Stats>();
+    auto worklist = PriorityWorklist(graph.numBlocks());
+    fillTop(blockIn, graph.numBlocks());
+    fillTop(blockOut, graph.numBlocks());
+    for (unsigned p = 0; p < graph.numBlocks(); p++) {
+      worklist.push(p);
+    }
+    endPhase<Stats>(stats.initSeconds, start);
+
+    while (!worklist.empty()) {
+      auto block = blockOrder[worklist.pop()];
+      count<Stats>(stats.iterations);
+
+      for (auto prev : prevBlocks(block)) {
+        meetInto(blockIn[block], blockOut[prev]);
+        count<Stats>(stats.meets);
       }
+      internValue(blockIn[block]);
 
-      auto old_out = out[node];
-      // Apply transfer function
-      out[node] = transferFunction(node, in[node]);
+      auto value = arenaCopy(blockIn[block]);
+      forEachInstr(block, [&](unsigned n) {
+        auto output = arenaCopy(top);
+        transfer<Stats>(n, value, output);
+        value = std::move(output);
+      });
+      // Only block facts are kept, facts within the block stay drafts
+      internValue(value);
 
-      // Add to worklist if output changed
-      if (!(out[node] == old_out)) {
-        for (auto &next : nextInstrs(*node)) {
-          worklist.insert(next);
+      if (!(value == blockOut[block])) {
+        count<Stats>(stats.changes);
+        blockOut[block] = value;
+        for (auto next : nextBlocks(block)) {
+          worklist.push(blockPriority[next]);
         }
       }
     }
+    endPhase<Stats>(stats.solveSeconds, start);
+
+    expanded = false;
   }
 
-  virtual auto print() -> void {
-    errs() << "Function: " << func.getName() << "\n";
+  /// Solve one fact at a time. A fact enters a block if it leaves one of the
+  /// block's predecessors (in analysis direction), and it leaves a block if
+  /// it is generated after the last instruction killing it, or if it enters
+  /// the block and nothing in the block kills it.
+  template <bool Stats> auto runSparse() -> void {
+    if constexpr (std::is_base_of_v<BitVectorInfo<Info>, Info>) {
+      auto start = startPhase<Stats>();
+      // Gen / kill sites of every fact, as (block, position in analysis
+      // direction + 1). Killing and generating the same fact at once counts
+      // as generating it.
+      using Site = std::pair<unsigned, unsigned>;
+      auto numFacts = top.universe->size();
+      auto gens = std::vector<std::vector<Site>>(numFacts);
+      auto kills = std::vector<std::vector<Site>>(numFacts);
+      auto gen = SmallVector<unsigned, 8>();
+      auto kill = SmallVector<unsigned, 8>();
+      for (unsigned b = 0; b < graph.numBlocks(); b++) {
+        auto position = 0u;
+        forEachInstr(b, [&](unsigned n) {
+          position += 1;
+          gen.clear();
+          kill.clear();
+          genKill(graph[n], gen, kill);
+          for (auto fact : gen) {
+            gens[fact].push_back({b, position});
+          }
+          for (auto fact : kill) {
+            if (!is_contained(gen, fact)) {
+              kills[fact].push_back({b, position});
+            }
+          }
+        });
+      }
 
-    auto map = indexInstrs(func);
-    for (auto &BB : func) {
-      for (auto &I : BB) {
-        errs() << map[&I] << "\t:";
-        I.print(errs());
-        errs() << "\n"
-               << "in"
-               << "\t: ";
-        in[&I].print(map);
-        errs() << "\n"
-               << "out"
-               << "\t: ";
-        out[&I].print(map);
-        errs() << "\n";
+      fillTop(blockIn, graph.numBlocks());
+      endPhase<Stats>(stats.initSeconds, start);
+      auto lastGen = DenseMap<unsigned, unsigned>();
+      auto lastKill = DenseMap<unsigned, unsigned>();
+      auto worklist = std::vector<unsigned>();
+      for (unsigned fact = 0; fact < numFacts; fact++) {
+        lastGen.clear();
+        lastKill.clear();
+        for (auto [b, position] : gens[fact]) {
+          lastGen[b] = std::max(lastGen[b], position);
+        }
+        for (auto [b, position] : kills[fact]) {
+          lastKill[b] = std::max(lastKill[b], position);
+        }
+
+        for (auto [b, position] : lastGen) {
+          if (position > lastKill.lookup(b)) {
+            auto next = nextBlocks(b);
+            worklist.insert(worklist.end(), next.begin(), next.end());
+          }
+        }
+        while (!worklist.empty()) {
+          auto b = worklist.back();
+          worklist.pop_back();
+          count<Stats>(stats.iterations);
+          if (!blockIn[b].set(fact)) {
+            continue;
+          }
+          count<Stats>(stats.changes);
+          if (lastKill.count(b)) {
+            continue;
+          }
+          auto next = nextBlocks(b);
+          worklist.insert(worklist.end(), next.begin(), next.end());
+        }
+      }
+      for (auto &value : blockIn) {
+        value.intern();
       }
+      endPhase<Stats>(stats.solveSeconds, start);
+
+      expanded = false;
+    } else {
+      report_fatal_error("the sparse solver needs a bit-vector lattice");
     }
+  }
 
-    errs() << "\n";
+  /// Recover instruction facts from block facts, only needed after
+  /// `runPerBlock` and `runSparse`
+  auto expand() -> void {
+    if (expanded) {
+      return;
+    }
+    if (statsEnabled) {
+      expandFacts<true>();
+    } else {
+      expandFacts<false>();
+    }
+    expanded = true;
   }
 
-  virtual auto transferFunction(Instruction *instr, Info input) -> Info = 0;
+  template <bool Stats> auto expandFacts() -> void {
+    auto start = startPhase<Stats>();
+    fillTop(in, graph.size());
+    fillTop(out, graph.size());
+    for (unsigned b = 0; b < graph.numBlocks(); b++) {
+      auto value = arenaCopy(blockIn[b]);
+      forEachInstr(b, [&](unsigned n) {
+        in[n] = std::move(value);
+        out[n] = top;
+        count<Stats>(stats.replays);
+        internValue(in[n]);
+        transferInPlace(graph[n], in[n], out[n]);
+        internValue(out[n]);
+        value = out[n];
+      });
+    }
+    endPhase<Stats>(stats.expandSeconds, start);
+  }
 
-private:
-  std::map<Instruction *, Info> in;
-  std::map<Instruction *, Info> out;
-  std::set<Instruction *> worklist;
+  std::unique_ptr<InstrGraph> ownedGraph;
+  const InstrGraph &graph;
+  /// Memory of the lattice values, declared before them so that it
+  /// outlives them
+  LatticeArena arena;
+  Info top;
+  /// Instructions and blocks in visiting order, and their position in it
+  std::vector<unsigned> order;
+  std::vector<unsigned> priority;
+  std::vector<unsigned> blockOrder;
+  std::vector<unsigned> blockPriority;
+  bool statsEnabled = false;
+  SolverStats stats;
+  /// Lattice values, addressed by the index of the instruction / block in
+  /// `graph`
+  std::vector<Info> in;
+  std::vector<Info> out;
+  std::vector<Info> blockIn;
+  std::vector<Info> blockOut;
+  /// Whether `in` and `out` hold instruction facts
+  bool expanded = false;
+  raw_ostream *os = &errs();
   Function &func;
+  SolverMode mode;
 };
\ No newline at end of file
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <map>
+#include <optional>
 #include <set>
+#include <string>
 
 #include "Bimap.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/Support/ErrorHandling.h"
 
 using namespace llvm;
 
@@ -41,10 +44,55 @@ static auto union2(const std::set<T> &a, const std::set<T> &b) -> std::set<T> {
 }
 } // namespace set
 
-/// Assign index to each instruction
+/// Parameters of a pipeline element, e.g. `reaching<block;stats>` yields
+/// {"block": "", "stats": ""}, and `<key=value>` yields {"key": "value"}
+using PassParams = std::map<std::string, std::string>;
+
+/// Return parameters if `Name` refers to the pass `PassName`, with or without
+/// parameters in angle brackets. Return `std::nullopt` otherwise.
+static inline auto parsePassParams(StringRef Name, StringRef PassName)
+    -> std::optional<PassParams> {
+  if (Name == PassName) {
+    return PassParams();
+  }
+  if (!Name.consume_front(PassName) || !Name.consume_front("<") ||
+      !Name.consume_back(">")) {
+    return std::nullopt;
+  }
+
+  auto params = PassParams();
+  while (!Name.empty()) {
+    auto [param, rest] = Name.split(';');
+    auto [key, value] = param.split('=');
+    params[key.str()] = value.str();
+    Name = rest;
+  }
+
+  return params;
+}
+
+/// Value of the positive integer parameter `key`, e.g. `sample=N`, or
+/// `fallback` if it is absent or has no value. Anything else, including 0,
+/// is a fatal error naming the parameter.
+static inline auto parsePositiveParam(const PassParams &params, StringRef key,
+                                      uint64_t fallback) -> uint64_t {
+  auto it = params.find(key.str());
+  if (it == params.end() || it->second.empty()) {
+    return fallback;
+  }
+  uint64_t value;
+  if (StringRef(it->second).getAsInteger(10, value) || value == 0) {
+    report_fatal_error("invalid pass parameter " + key + "=" + it->second +
+                       ", expected a positive integer");
+  }
+  return value;
+}
+
+/// Assign index to each instruction, starting at 1. Analyses built on
+/// `InstrGraph` share its `numbering` instead.
 static inline auto indexInstrs(Function &F) {
   auto bimap = Bimap<Instruction *, unsigned>();
-  auto count = 0;
+  auto count = 0u;
 
   for (auto &BB : F) {
     for (auto &I : BB) {
@@ -108,4 +156,4 @@ static inline auto getInstrSucc(Instruction &I) -> std::set<Instruction *> {
   }
 
   return result;
-}
\ No newline at end of file
+}
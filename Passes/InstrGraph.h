@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "Bimap.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+/// Compact instruction-level control flow graph of a function, built once and
+/// shared by every analysis running on the function.
+///
+/// Instructions and blocks are numbered in layout order, i.e. the instruction
+/// printed as `n` is node `n - 1`. `numbering` maps both ways between
+/// instructions and printed numbers, printers share it instead of numbering
+/// instructions again. The instructions of block `b` are nodes
+/// `blockBegin[b]` up to (excluding) `blockBegin[b + 1]`.
+///
+/// Edges are stored CSR-style: the predecessors of node `n` are
+/// `predEdges[predOffsets[n]]` up to (excluding) `predEdges[predOffsets[n+1]]`,
+/// and likewise for successors and for blocks. Iterating them never
+/// allocates.
+class InstrGraph {
+public:
+  InstrGraph(Function &F) : func(&F) {
+    numbers.reserve(F.getInstructionCount());
+    for (auto &BB : F) {
+      blockIndex[&BB] = blocks.size();
+      blocks.push_back(&BB);
+      blockBegin.push_back(numInstrs);
+      for (auto &I : BB) {
+        numInstrs += 1;
+        numbers.insert(&I, numInstrs);
+      }
+    }
+    blockBegin.push_back(numInstrs);
+
+    // Block edges, with duplicates from e.g. `switch` removed
+    auto predLists = std::vector<std::vector<unsigned>>(blocks.size());
+    auto succLists = std::vector<std::vector<unsigned>>(blocks.size());
+    for (unsigned b = 0; b < blocks.size(); b++) {
+      for (auto succ : successors(blocks[b])) {
+        succLists[b].push_back(blockIndex[succ]);
+        predLists[blockIndex[succ]].push_back(b);
+      }
+    }
+    for (unsigned b = 0; b < blocks.size(); b++) {
+      appendUnique(blockPredOffsets, blockPredEdges, predLists[b]);
+      appendUnique(blockSuccOffsets, blockSuccEdges, succLists[b]);
+    }
+    blockPredOffsets.push_back(blockPredEdges.size());
+    blockSuccOffsets.push_back(blockSuccEdges.size());
+
+    // Instruction edges: inside a block an instruction is only connected to
+    // its neighbours, the first and last ones are connected to the
+    // terminators / leaders of adjacent blocks
+    for (unsigned b = 0; b < blocks.size(); b++) {
+      for (auto n = blockBegin[b]; n < blockBegin[b + 1]; n++) {
+        predOffsets.push_back(predEdges.size());
+        if (n == blockBegin[b]) {
+          for (auto pred : blockPreds(b)) {
+            predEdges.push_back(blockBegin[pred + 1] - 1);
+          }
+        } else {
+          predEdges.push_back(n - 1);
+        }
+
+        succOffsets.push_back(succEdges.size());
+        if (n == blockBegin[b + 1] - 1) {
+          for (auto succ : blockSuccs(b)) {
+            succEdges.push_back(blockBegin[succ]);
+          }
+        } else {
+          succEdges.push_back(n + 1);
+        }
+      }
+    }
+    predOffsets.push_back(predEdges.size());
+    succOffsets.push_back(succEdges.size());
+
+    // Reverse postorder of blocks, unreachable blocks are not part of the
+    // traversal and go last
+    auto visited = std::vector<bool>(blocks.size());
+    for (auto BB : ReversePostOrderTraversal<Function *>(&F)) {
+      visited[blockIndex[BB]] = true;
+      blockRPO.push_back(blockIndex[BB]);
+    }
+    for (unsigned b = 0; b < blocks.size(); b++) {
+      if (!visited[b]) {
+        blockRPO.push_back(b);
+      }
+    }
+  }
+
+  auto getFunction() const -> Function & { return *func; }
+
+  /// Number of instructions
+  auto size() const -> unsigned { return numInstrs; }
+
+  auto operator[](unsigned n) const -> Instruction * { return numbers[n + 1]; }
+
+  auto indexOf(Instruction *I) const -> unsigned { return numbers[I] - 1; }
+
+  /// Instructions and the numbers they are printed as, starting at 1
+  auto numbering() const -> const Bimap<Instruction *, unsigned> & {
+    return numbers;
+  }
+
+  auto preds(unsigned n) const -> ArrayRef<unsigned> {
+    return edges(predOffsets, predEdges, n);
+  }
+
+  auto succs(unsigned n) const -> ArrayRef<unsigned> {
+    return edges(succOffsets, succEdges, n);
+  }
+
+  /// Number of basic blocks
+  auto numBlocks() const -> unsigned { return blocks.size(); }
+
+  auto block(unsigned b) const -> BasicBlock * { return blocks[b]; }
+
+  auto blockIndexOf(const BasicBlock *BB) const -> unsigned {
+    return blockIndex.find(BB)->second;
+  }
+
+  /// First instruction of block `b`
+  auto begin(unsigned b) const -> unsigned { return blockBegin[b]; }
+
+  /// One past the last instruction of block `b`
+  auto end(unsigned b) const -> unsigned { return blockBegin[b + 1]; }
+
+  auto blockPreds(unsigned b) const -> ArrayRef<unsigned> {
+    return edges(blockPredOffsets, blockPredEdges, b);
+  }
+
+  auto blockSuccs(unsigned b) const -> ArrayRef<unsigned> {
+    return edges(blockSuccOffsets, blockSuccEdges, b);
+  }
+
+  /// Blocks in reverse postorder
+  auto reversePostOrder() const -> ArrayRef<unsigned> { return blockRPO; }
+
+private:
+  static auto appendUnique(std::vector<unsigned> &offsets,
+                           std::vector<unsigned> &edges,
+                           std::vector<unsigned> nodes) -> void {
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    offsets.push_back(edges.size());
+    edges.insert(edges.end(), nodes.begin(), nodes.end());
+  }
+
+  static auto edges(const std::vector<unsigned> &offsets,
+                    const std::vector<unsigned> &edges, unsigned n)
+      -> ArrayRef<unsigned> {
+    return ArrayRef<unsigned>(edges.data() + offsets[n],
+                              edges.data() + offsets[n + 1]);
+  }
+
+  Function *func;
+  unsigned numInstrs = 0;
+  /// Node `n` is instruction number `n + 1`
+  Bimap<Instruction *, unsigned> numbers;
+  std::vector<BasicBlock *> blocks;
+  DenseMap<const BasicBlock *, unsigned> blockIndex;
+  std::vector<unsigned> blockBegin;
+  std::vector<unsigned> predOffsets, predEdges;
+  std::vector<unsigned> succOffsets, succEdges;
+  std::vector<unsigned> blockPredOffsets, blockPredEdges;
+  std::vector<unsigned> blockSuccOffsets, blockSuccEdges;
+  std::vector<unsigned> blockRPO;
+};
+
+/// Makes `InstrGraph` available through the function analysis manager, so
+/// that passes in the same pipeline share a single graph per function.
+/// Register it with `registerInstrGraphAnalysis` in the plugin callback.
+/// The graph is rebuilt after any pass that does not preserve all analyses.
+struct InstrGraphAnalysis : public AnalysisInfoMixin<InstrGraphAnalysis> {
+  using Result = InstrGraph;
+
+  auto run(Function &F, FunctionAnalysisManager &) -> InstrGraph {
+    return InstrGraph(F);
+  }
+
+  inline static AnalysisKey Key;
+};
+
+static inline auto registerInstrGraphAnalysis(FunctionAnalysisManager &FAM) {
+  FAM.registerPass([] { return InstrGraphAnalysis(); });
+}
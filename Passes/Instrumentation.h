@@ -0,0 +1,55 @@
+#pragma once
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+/// Helpers for the instrumentation passes (`cdi`, `bb`), inserting the code
+/// that updates counters in the instrumented program
+
+/// Insert `counters[index] += amount` before the insertion point of
+/// `builder`, where `counters` is a global array of type `countersType`
+static inline auto incrementCounter(IRBuilder<> &builder,
+                                    ArrayType *countersType,
+                                    Constant *counters, unsigned index,
+                                    Value *amount) -> void {
+  auto counter =
+      builder.CreateConstInBoundsGEP2_64(countersType, counters, 0, index);
+  auto count = builder.CreateLoad(builder.getInt64Ty(), counter);
+  builder.CreateStore(builder.CreateAdd(count, amount), counter);
+}
+
+/// Insert `if (--countdown <= 0) countdown = callee(args...)` before
+/// `before`, where `countdown` is the thread-local `int64_t` sampling
+/// countdown of the module named `countdownName`, created on first use.
+/// `callee` is the slow path of the runtime: it records a sample and returns
+/// the distance to the next one. Every module counts down on its own, so
+/// modules sampled with different periods do not skew each other. The
+/// countdown uses the initial-exec TLS model, i.e. instrumented code must be
+/// linked into the executable rather than `dlopen`ed. The block of `before`
+/// is split.
+static inline auto insertSampleCall(Instruction *before,
+                                    StringRef countdownName,
+                                    FunctionCallee callee,
+                                    ArrayRef<Value *> args) -> void {
+  auto M = before->getModule();
+  auto builder = IRBuilder<>(before);
+  auto countdown =
+      M->getOrInsertGlobal(countdownName, builder.getInt64Ty(), [&] {
+        return new GlobalVariable(*M, builder.getInt64Ty(), false,
+                                  GlobalValue::InternalLinkage,
+                                  builder.getInt64(0), countdownName, nullptr,
+                                  GlobalValue::InitialExecTLSModel);
+      });
+
+  auto count = builder.CreateLoad(builder.getInt64Ty(), countdown);
+  auto decremented = builder.CreateSub(count, builder.getInt64(1));
+  builder.CreateStore(decremented, countdown);
+  auto expired = builder.CreateICmpSLE(decremented, builder.getInt64(0));
+  builder.SetInsertPoint(SplitBlockAndInsertIfThen(
+      expired, before, false,
+      MDBuilder(M->getContext()).createBranchWeights(1, 1000)));
+  builder.CreateStore(builder.CreateCall(callee, args), countdown);
+}
@@ -1,4 +1,6 @@
+#include "AnalysisCache.h"
 #include "DFAFramework.h"
+#include "ParallelDriver.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 
@@ -8,34 +10,31 @@ static auto PASS_NAME = "LiveVariablePass";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "liveness";
 
-class VarInfo {
+/// Set of live values, stored as a bit vector over every value used in the
+/// function
+class VarInfo : public BitVectorInfo<VarInfo> {
 public:
   /// Interestingly, while the default constructor is never explicitly called,
   /// removing it will result in a compile error
   VarInfo() {}
-  VarInfo(std::set<Value *> set) : defs(set) {}
+  VarInfo(const ValueUniverse *universe) : BitVectorInfo(universe) {}
 
   /// Print definition set for a given statement
   /// Called by `print` method of class `DataFlowAnalysis`
-  auto print(Bimap<Instruction *, unsigned> &) -> void {
-    for (auto &def : defs) {
-      def->printAsOperand(errs());
-      errs() << " ";
-    }
-  }
-
-  /// Return true if definition sets have the same definitions
-  auto operator==(const VarInfo &other) const -> bool {
-    return defs == other.defs;
+  auto print(raw_ostream &OS, const Bimap<Instruction *, unsigned> &) -> void {
+    forEach([&](Value *def) {
+      def->printAsOperand(OS);
+      OS << " ";
+    });
   }
 
   /// Meet operator for reaching definition analysis is simply union for
   /// definition set
   auto operator^(const VarInfo &other) const -> VarInfo {
-    return VarInfo(set::union2(defs, other.defs));
+    return *this | other;
   }
 
-  std::set<Value *> defs;
+  auto operator^=(const VarInfo &other) -> VarInfo & { return *this |= other; }
 };
 
 class LiveVariableAnalysis
@@ -44,31 +43,82 @@ public:
   /// Inherit constructor
   using DataFlowAnalysis::DataFlowAnalysis;
 
-  /// Note that the kill set if always empty due to the SSA property.
-  /// Thus the output of the transfer function is the union of input and
-  /// Definition generated by the current instruction. (if any)
-  virtual auto transferFunction(Instruction *instr, VarInfo input) -> VarInfo {
+  /// Live variables before an instruction are those live after it, minus
+  /// the value it defines, plus its operands.
+  /// Live sets only grow while solving, and the defined value is never part
+  /// of the output unless it is also an operand (e.g. a `phi` in a loop), so
+  /// the update can be done by merging into the previous output.
+  virtual auto transferInPlace(Instruction *instr, const VarInfo &input,
+                               VarInfo &output) -> bool {
+    auto def = hasRetValue(*instr) ? output.universe->indexOf(instr) : ~0u;
+    auto changed = output.unionWith(input, def);
+    for (auto &op : instr->operands()) {
+      changed |= output.insert(op);
+    }
+    return changed;
+  }
+
+  /// A value becomes live at each of its uses, i.e. along its def-use
+  /// edges, and dies at its definition
+  virtual auto genKill(Instruction *instr, SmallVectorImpl<unsigned> &gen,
+                       SmallVectorImpl<unsigned> &kill) -> void {
     if (hasRetValue(*instr)) {
-      input.defs.erase(instr);
+      kill.push_back(getTop().universe->indexOf(instr));
     }
     for (auto &op : instr->operands()) {
-      input.defs.insert(op);
+      gen.push_back(getTop().universe->indexOf(op));
     }
-    return input;
   }
 };
 
 namespace {
 struct ReachingDefinitionPass : public PassInfoMixin<ReachingDefinitionPass> {
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-    // Instantiate reaching definition analysis with 'top' value of lattice
-    auto analysis = LiveVariableAnalysis({}, F);
-
-    analysis.run();
-    analysis.print();
+  ReachingDefinitionPass(const PassParams &params)
+      : mode(parseSolverMode(params)), stats(params.count("stats")),
+        quiet(params.count("quiet")),
+        cache(makeAnalysisCache(params, ARGUMENT_NAME)) {}
 
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+    // Instruction graph shared with other analyses of the same function
+    analyze(F, FAM.getResult<InstrGraphAnalysis>(F), errs());
     return PreservedAnalyses::all();
   }
+
+  /// Analyze one function and print results to `OS`.
+  /// Also called concurrently by `ParallelAnalysisPass`.
+  auto analyze(Function &F, const InstrGraph &graph, raw_ostream &OS) const
+      -> void {
+    // Every value that can become live is an operand of some instruction
+    auto universe = ValueUniverse::operands(F);
+    // Instantiate reaching definition analysis with 'top' value of lattice
+    auto analysis = LiveVariableAnalysis(VarInfo(&universe), graph, mode);
+    analysis.setOutput(OS);
+    if (stats) {
+      analysis.enableStats();
+    }
+
+    auto status = std::string();
+    if (cache) {
+      status = cache->solve(analysis, F, universe);
+    } else {
+      analysis.run();
+    }
+    if (!quiet) {
+      analysis.print();
+    }
+    if (cache) {
+      OS << "Cache: " << status << "\n";
+    }
+    if (stats) {
+      analysis.printStats();
+    }
+  }
+
+  SolverMode mode;
+  bool stats;
+  /// Solve without printing the facts, e.g. for benchmarks
+  bool quiet;
+  std::shared_ptr<AnalysisCache> cache;
 };
 } // namespace
 
@@ -76,11 +126,25 @@ extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
 llvmGetPassPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, PASS_NAME, PASS_VERSION,
           [](PassBuilder &PB) {
+            PB.registerAnalysisRegistrationCallback(registerInstrGraphAnalysis);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == ARGUMENT_NAME) {
-                    FPM.addPass(ReachingDefinitionPass());
+                  if (auto params = parsePassParams(Name, ARGUMENT_NAME)) {
+                    FPM.addPass(ReachingDefinitionPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && params->count("parallel")) {
+                    // Analyze all functions of the module concurrently
+                    MPM.addPass(ParallelAnalysisPass(
+                        ReachingDefinitionPass(*params), *params));
                     return true;
                   } else {
                     return false;
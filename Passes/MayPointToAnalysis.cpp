@@ -1,6 +1,12 @@
+#include "AnalysisCache.h"
 #include "DFAFramework.h"
+#include "ParallelDriver.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/MathExtras.h"
 
 using namespace llvm;
 
@@ -8,59 +14,486 @@ static auto PASS_NAME = "MayPointToAnalysis";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "maypointto";
 
+/// Abstract memory locations of a function: allocation sites (allocas and
+/// the globals the function uses), each split into fields by byte offset.
+/// Locations are numbered as they are first reached, so that points-to sets
+/// are bitmaps of location numbers.
+///
+/// Offsets outside of a site, and offsets into a site of unknown size, are
+/// collapsed into one location per site with offset `UNKNOWN`, standing for
+/// any of its fields. This also bounds the number of locations when a loop
+/// keeps advancing a pointer.
+class LocationTable {
+public:
+  static constexpr int64_t UNKNOWN = std::numeric_limits<int64_t>::min();
+
+  LocationTable(Function &F) : layout(F.getParent()->getDataLayout()) {
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (auto alloca = dyn_cast<AllocaInst>(&I)) {
+          auto bits = alloca->getAllocationSizeInBits(layout);
+          addSite(alloca, bits && !bits->isScalable()
+                              ? int64_t(bits->getFixedSize() / 8)
+                              : UNKNOWN);
+        }
+        for (auto &op : I.operands()) {
+          int64_t offset;
+          if (auto global = dyn_cast_or_null<GlobalVariable>(
+                  stripConstant(op, offset))) {
+            addSite(global,
+                    int64_t(layout.getTypeAllocSize(global->getValueType())));
+          }
+        }
+      }
+    }
+  }
+
+  /// Base object of a constant pointer, e.g. a global or a constant
+  /// `getelementptr` into one, and the byte offset into it
+  auto stripConstant(Value *V, int64_t &offset) const -> Value * {
+    if (!isa<Constant>(V) || !V->getType()->isPointerTy()) {
+      return nullptr;
+    }
+    auto bytes = APInt(layout.getIndexTypeSizeInBits(V->getType()), 0);
+    auto base = V->stripAndAccumulateConstantOffsets(
+        layout, bytes, /*AllowNonInbounds=*/true);
+    offset = bytes.getSExtValue();
+    return base;
+  }
+
+  /// Site number of `V`, or -1 if it is not an allocation site
+  auto siteOf(Value *V) const -> int { return siteNumbers.lookup(V) - 1; }
+
+  auto numSites() const -> unsigned { return sites.size(); }
+
+  auto siteValue(unsigned site) const -> Value * { return sites[site].value; }
+
+  /// Location `offset` bytes into `site`
+  auto get(unsigned site, int64_t offset) -> unsigned {
+    auto size = sites[site].size;
+    if (size == UNKNOWN || offset < 0 || offset >= size) {
+      offset = UNKNOWN;
+    }
+    auto [it, inserted] = numbers.try_emplace({site, offset}, locations.size());
+    if (inserted) {
+      locations.push_back({site, offset});
+      sites[site].fields.push_back(it->second);
+    }
+    return it->second;
+  }
+
+  /// Location `offset` bytes after `location`, possibly unknown
+  auto advance(unsigned location, int64_t offset) -> unsigned {
+    auto [site, start] = locations[location];
+    return get(site, start == UNKNOWN ? UNKNOWN : start + offset);
+  }
+
+  auto site(unsigned location) const -> unsigned {
+    return locations[location].first;
+  }
+
+  auto offset(unsigned location) const -> int64_t {
+    return locations[location].second;
+  }
+
+  /// Every location of the site of `location` reached so far
+  auto fields(unsigned location) const -> ArrayRef<unsigned> {
+    return sites[site(location)].fields;
+  }
+
+  /// Order of printing and saving, by site and offset, independent of when
+  /// the locations were reached
+  auto before(unsigned a, unsigned b) const -> bool {
+    return locations[a] < locations[b];
+  }
+
+  /// `%site`, `%site+offset` or `%site+?`
+  auto print(raw_ostream &OS, unsigned location) const -> void {
+    auto [site, offset] = locations[location];
+    sites[site].value->printAsOperand(OS, /*PrintType=*/false);
+    if (offset == UNKNOWN) {
+      OS << "+?";
+    } else if (offset != 0) {
+      OS << "+" << offset;
+    }
+  }
+
+  const DataLayout &layout;
+
+private:
+  auto addSite(Value *V, int64_t size) -> void {
+    if (siteNumbers.try_emplace(V, sites.size() + 1).second) {
+      sites.push_back({V, size, {}});
+    }
+  }
+
+  struct Site {
+    Value *value;
+    /// Size in bytes, or `UNKNOWN`
+    int64_t size;
+    SmallVector<unsigned, 4> fields;
+  };
+
+  /// Site numbers + 1, so that absent values map to -1
+  DenseMap<Value *, int> siteNumbers;
+  std::vector<Site> sites;
+  /// (site, offset) of every location, and their numbers
+  std::vector<std::pair<unsigned, int64_t>> locations;
+  DenseMap<std::pair<unsigned, int64_t>, unsigned> numbers;
+};
+
+/// Set of location numbers, as a bitmap allocated from the memory resource
+/// it is constructed with. The maps of `PtrInfo` pass their resource on to
+/// the sets they hold (uses-allocator construction), so the sets of lattice
+/// values live in the arena of the analysis too.
+///
+/// Locations are numbered densely per function, and the bitmap only extends
+/// to the word of the largest member. Bits are never cleared, so the last
+/// word is never zero and equal sets have equal words.
+class LocationSet {
+public:
+  using allocator_type = std::pmr::polymorphic_allocator<uint64_t>;
+
+  LocationSet() = default;
+  LocationSet(const LocationSet &) = default;
+  LocationSet(LocationSet &&) = default;
+  explicit LocationSet(const allocator_type &alloc) : words(alloc) {}
+  LocationSet(const LocationSet &other, const allocator_type &alloc)
+      : words(other.words, alloc) {}
+  LocationSet(LocationSet &&other, const allocator_type &alloc)
+      : words(std::move(other.words), alloc) {}
+
+  auto operator=(const LocationSet &) -> LocationSet & = default;
+  auto operator=(LocationSet &&) -> LocationSet & = default;
+
+  /// Forward iterator over the members, in increasing order
+  class iterator {
+  public:
+    iterator(const std::pmr::vector<uint64_t> &words, size_t bit)
+        : words(&words), bit(bit) {
+      skip();
+    }
+
+    auto operator*() const -> unsigned { return bit; }
+
+    auto operator++() -> iterator & {
+      bit += 1;
+      skip();
+      return *this;
+    }
+
+    auto operator!=(const iterator &other) const -> bool {
+      return bit != other.bit;
+    }
+
+  private:
+    /// Move to the next member at or after `bit`, or to the end
+    auto skip() -> void {
+      auto end = words->size() * 64;
+      while (bit < end) {
+        auto word = (*words)[bit / 64] >> (bit % 64);
+        if (word != 0) {
+          bit += countTrailingZeros(word);
+          return;
+        }
+        bit = (bit / 64 + 1) * 64;
+      }
+    }
+
+    const std::pmr::vector<uint64_t> *words;
+    size_t bit;
+  };
+
+  auto begin() const -> iterator { return iterator(words, 0); }
+  auto end() const -> iterator { return iterator(words, words.size() * 64); }
+
+  auto empty() const -> bool { return words.empty(); }
+
+  auto count() const -> size_t {
+    size_t count = 0;
+    for (auto word : words) {
+      count += countPopulation(word);
+    }
+    return count;
+  }
+
+  /// Add `loc`, return true if it was not a member yet
+  auto test_and_set(unsigned loc) -> bool {
+    if (loc / 64 >= words.size()) {
+      words.resize(loc / 64 + 1);
+    }
+    auto &word = words[loc / 64];
+    auto bit = uint64_t(1) << (loc % 64);
+    auto added = (word & bit) == 0;
+    word |= bit;
+    return added;
+  }
+
+  auto set(unsigned loc) -> void { test_and_set(loc); }
+
+  /// Union `other` into this set, return true if anything was added
+  auto operator|=(const LocationSet &other) -> bool {
+    if (other.words.size() > words.size()) {
+      words.resize(other.words.size());
+    }
+    auto changed = false;
+    for (size_t i = 0; i < other.words.size(); i++) {
+      auto word = words[i] | other.words[i];
+      changed |= word != words[i];
+      words[i] = word;
+    }
+    return changed;
+  }
+
+  auto operator==(const LocationSet &other) const -> bool {
+    return words == other.words;
+  }
+
+private:
+  std::pmr::vector<uint64_t> words;
+};
+
 class PtrInfo {
 public:
+  /// Maps allocate from the memory resource they are constructed with, the
+  /// arena of the analysis for the values it stores
+  using PointerMap = std::pmr::map<Value *, LocationSet>;
+  using MemoryMap = std::pmr::map<unsigned, LocationSet>;
+
   /// Interestingly, while the default constructor is never explicitly called,
   /// removing it will result in a compile error
   PtrInfo() {}
-  PtrInfo(std::map<Value *, std::set<Value *>> map) : ptr2val(map) {}
+  PtrInfo(LocationTable *locations) : locations(locations) {}
 
-  /// Print definition set for a given statement
+  /// Copy of `other` allocated from `arena`, see `HasArenaCopy`
+  PtrInfo(const PtrInfo &other, std::pmr::memory_resource *arena)
+      : pointers(other.pointers, arena), memory(other.memory, arena),
+        locations(other.locations) {}
+
+  /// Print the points-to set of every pointer, then the pointers stored in
+  /// every location, as `*location`
   /// Called by `print` method of class `DataFlowAnalysis`
-  auto print(Bimap<Instruction *, unsigned> &) -> void {
-    for (auto &[p, vs] : ptr2val) {
-      p->printAsOperand(errs());
-      errs() << ":";
-      for (auto v : vs) {
-        errs() << "\n";
-        v->printAsOperand(errs());
-      }
-      errs() << "\n";
+  auto print(raw_ostream &OS, const Bimap<Instruction *, unsigned> &) -> void {
+    for (auto &[p, locs] : pointers) {
+      p->printAsOperand(OS);
+      OS << ":";
+      printSet(OS, locs);
+    }
+    auto stored = std::vector<unsigned>();
+    for (auto &[loc, locs] : memory) {
+      stored.push_back(loc);
+    }
+    sortLocations(stored);
+    for (auto loc : stored) {
+      OS << "*";
+      locations->print(OS, loc);
+      OS << ":";
+      printSet(OS, memory.at(loc));
     }
   }
 
-  /// Return true if definition sets have the same definitions
+  /// Return true if both map the same pointers and locations to the same
+  /// locations
   auto operator==(const PtrInfo &other) const -> bool {
-    return ptr2val == other.ptr2val;
+    return pointers == other.pointers && memory == other.memory;
   }
 
-  /// Meet operator for reaching definition analysis is simply union for
-  /// definition set
+  /// Meet operator for may point to analysis is the union of the maps
   auto operator^(const PtrInfo &other) const -> PtrInfo {
-    // Make a copy of our own ptr2val map
-    auto result = ptr2val;
-    for (const auto &[p, v] : other.ptr2val) {
-      if (result.find(p) != result.end()) {
-        result[p] = set::union2(result[p], v);
-      } else {
-        result[p] = v;
+    // Make a copy of our own maps, in the same memory
+    auto result = PtrInfo(*this, pointers.get_allocator().resource());
+    result.merge(other);
+    return result;
+  }
+
+  auto operator^=(const PtrInfo &other) -> PtrInfo & {
+    merge(other);
+    return *this;
+  }
+
+  /// Union `other` into these maps in place, return true if anything was
+  /// added
+  auto merge(const PtrInfo &other) -> bool {
+    auto changed = false;
+    for (const auto &[p, locs] : other.pointers) {
+      changed |= pointers[p] |= locs;
+    }
+    for (const auto &[loc, locs] : other.memory) {
+      changed |= memory[loc] |= locs;
+    }
+    return changed;
+  }
+
+  /// Number of (pointer, location) and (location, location) pairs
+  auto size() const -> size_t {
+    size_t count = 0;
+    for (auto &[p, locs] : pointers) {
+      count += locs.count();
+    }
+    for (auto &[loc, locs] : memory) {
+      count += locs.count();
+    }
+    return count;
+  }
+
+  /// Save pointers as universe indices, and locations as the universe index
+  /// of their site and their offset, all in increasing order
+  auto save(FactWriter &writer, const ValueUniverse &universe) const -> void {
+    auto entries = std::vector<std::pair<unsigned, const LocationSet *>>();
+    for (auto &[p, locs] : pointers) {
+      entries.push_back({universe.indexOf(p), &locs});
+    }
+    std::sort(entries.begin(), entries.end());
+    writer.write(entries.size());
+    for (auto &[ptr, locs] : entries) {
+      writer.write(ptr);
+      saveSet(writer, universe, *locs);
+    }
+
+    auto stored = std::vector<unsigned>();
+    for (auto &[loc, locs] : memory) {
+      stored.push_back(loc);
+    }
+    sortLocations(stored);
+    writer.write(stored.size());
+    for (auto loc : stored) {
+      saveLocation(writer, universe, loc);
+      saveSet(writer, universe, memory.at(loc));
+    }
+  }
+
+  /// Load what `save` wrote, return false on values out of the universe
+  auto load(FactReader &reader, const ValueUniverse &universe) -> bool {
+    uint32_t numPtrs, ptr, numStored;
+    unsigned loc;
+    if (!reader.read(numPtrs)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < numPtrs; i++) {
+      if (!reader.read(ptr) || ptr >= universe.size() ||
+          !loadSet(reader, universe, pointers[universe[ptr]])) {
+        return false;
+      }
+    }
+    if (!reader.read(numStored)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < numStored; i++) {
+      if (!loadLocation(reader, universe, loc) ||
+          !loadSet(reader, universe, memory[loc])) {
+        return false;
       }
     }
+    return true;
+  }
 
+  /// Add the locations `V` may point to to `locs`, return true if any was
+  /// new. Allocation sites and constants derived from them point to
+  /// themselves, other values to what is recorded for them.
+  auto addPointees(Value *V, LocationSet &locs) const -> bool {
+    auto site = locations->siteOf(V);
+    int64_t offset = 0;
+    if (site < 0) {
+      if (auto base = locations->stripConstant(V, offset)) {
+        site = locations->siteOf(base);
+      }
+    }
+    if (site >= 0) {
+      return locs.test_and_set(locations->get(site, offset));
+    }
+    auto it = pointers.find(V);
+    return it != pointers.end() && (locs |= it->second);
+  }
+
+  /// Record that `alias` may point to whatever `ptr` may point to.
+  /// Return true if anything was added.
+  auto addPtrAlias(Value *ptr, Value *alias) -> bool {
+    // Only existing entries are read, so the reference to the entry of
+    // `alias` is not invalidated, even if `ptr` is `alias`
+    auto &locs = pointers[alias];
+    auto changed = addPointees(ptr, locs);
+    if (locs.empty()) {
+      pointers.erase(alias);
+    }
+    return changed;
+  }
+
+  PointerMap pointers;
+  /// Pointers stored in each location
+  MemoryMap memory;
+  LocationTable *locations = nullptr;
+
+private:
+  auto sortLocations(std::vector<unsigned> &locs) const -> void {
+    std::sort(locs.begin(), locs.end(), [&](unsigned a, unsigned b) {
+      return locations->before(a, b);
+    });
+  }
+
+  auto sorted(const LocationSet &locs) const -> std::vector<unsigned> {
+    auto result = std::vector<unsigned>();
+    for (auto loc : locs) {
+      result.push_back(loc);
+    }
+    sortLocations(result);
     return result;
   }
 
-  auto add_ptr_alias(Value *ptr, Value *alias) {
-    if (ptr2val.find(ptr) != ptr2val.end()) {
-      if (ptr2val.find(alias) != ptr2val.end()) {
-        ptr2val[alias] = set::union2(ptr2val[ptr], ptr2val[alias]);
-      } else {
-        ptr2val[alias] = ptr2val[ptr];
-      }
+  auto printSet(raw_ostream &OS, const LocationSet &locs) const -> void {
+    for (auto loc : sorted(locs)) {
+      OS << "\n";
+      locations->print(OS, loc);
+    }
+    OS << "\n";
+  }
+
+  auto saveLocation(FactWriter &writer, const ValueUniverse &universe,
+                    unsigned loc) const -> void {
+    auto offset = uint64_t(locations->offset(loc));
+    writer.write(universe.indexOf(locations->siteValue(locations->site(loc))));
+    writer.write(uint32_t(offset));
+    writer.write(uint32_t(offset >> 32));
+  }
+
+  auto loadLocation(FactReader &reader, const ValueUniverse &universe,
+                    unsigned &loc) const -> bool {
+    uint32_t index, low, high;
+    if (!reader.read(index) || index >= universe.size() ||
+        !reader.read(low) || !reader.read(high)) {
+      return false;
+    }
+    auto site = locations->siteOf(universe[index]);
+    if (site < 0) {
+      return false;
+    }
+    loc = locations->get(site, int64_t(uint64_t(high) << 32 | low));
+    return true;
+  }
+
+  auto saveSet(FactWriter &writer, const ValueUniverse &universe,
+               const LocationSet &locs) const -> void {
+    auto ordered = sorted(locs);
+    writer.write(ordered.size());
+    for (auto loc : ordered) {
+      saveLocation(writer, universe, loc);
     }
   }
 
-  std::map<Value *, std::set<Value *>> ptr2val;
+  auto loadSet(FactReader &reader, const ValueUniverse &universe,
+               LocationSet &locs) const -> bool {
+    uint32_t size;
+    unsigned loc;
+    if (!reader.read(size)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+      if (!loadLocation(reader, universe, loc)) {
+        return false;
+      }
+      locs.set(loc);
+    }
+    return true;
+  }
 };
 
 class MayPointToAnalysis
@@ -69,71 +502,203 @@ public:
   /// Inherit constructor
   using DataFlowAnalysis::DataFlowAnalysis;
 
-  virtual auto transferFunction(Instruction *instr, PtrInfo input) -> PtrInfo {
-    auto &map = input.ptr2val;
+  /// Points-to facts only grow while solving, so `input` is merged into the
+  /// previous output and the effect of `instr` is applied on top of it. Sets
+  /// are updated in place with the locations they gain, nothing is copied.
+  virtual auto transferInPlace(Instruction *instr, const PtrInfo &input,
+                               PtrInfo &output) -> bool {
+    auto changed = output.merge(input);
+    auto &locations = *output.locations;
     switch (instr->getOpcode()) {
     case Instruction::Alloca: {
-      // Hack to avoid duplicate, may be wrong!
-      map[instr] = {instr->getOperand(0)};
+      changed |= output.addPtrAlias(instr, instr);
       break;
     }
     case Instruction::BitCast:
+    case Instruction::AddrSpaceCast: {
+      changed |= output.addPtrAlias(instr->getOperand(0), instr);
+      break;
+    }
     case Instruction::GetElementPtr: {
-      input.add_ptr_alias(instr->getOperand(0), instr);
+      // Constant offsets select a field, others may reach any field
+      auto gep = cast<GetElementPtrInst>(instr);
+      auto bytes = APInt(locations.layout.getIndexTypeSizeInBits(
+                             gep->getPointerOperandType()),
+                         0);
+      auto offset = gep->accumulateConstantOffset(locations.layout, bytes)
+                        ? bytes.getSExtValue()
+                        : LocationTable::UNKNOWN;
+      auto base = LocationSet();
+      output.addPointees(gep->getPointerOperand(), base);
+      if (base.empty()) {
+        break;
+      }
+      auto &locs = output.pointers[instr];
+      for (auto loc : base) {
+        auto field = offset == LocationTable::UNKNOWN
+                         ? locations.get(locations.site(loc), offset)
+                         : locations.advance(loc, offset);
+        changed |= locs.test_and_set(field);
+      }
       break;
     }
     case Instruction::Load: {
-      auto ptr = instr->getOperand(0);
-      if (map.find(ptr) != map.end()) {
-        for (auto &x : map[ptr]) {
-          input.add_ptr_alias(x, instr);
+      // A known field holds what was stored to it, and what was stored to
+      // the unknown field of its site, which may have been any field. A load
+      // from the unknown field may read any field of the site reached so far.
+      if (!instr->getType()->isPointerTy()) {
+        break;
+      }
+      auto addresses = LocationSet();
+      output.addPointees(instr->getOperand(0), addresses);
+      auto &locs = output.pointers[instr];
+      for (auto address : addresses) {
+        auto unknown = locations.get(locations.site(address),
+                                     LocationTable::UNKNOWN);
+        auto read = [&](unsigned loc) {
+          auto it = output.memory.find(loc);
+          if (it != output.memory.end()) {
+            changed |= locs |= it->second;
+          }
+        };
+        if (address == unknown) {
+          for (auto loc : locations.fields(address)) {
+            read(loc);
+          }
+        } else {
+          read(address);
+          read(unknown);
         }
       }
+      if (locs.empty()) {
+        output.pointers.erase(instr);
+      }
       break;
     }
     case Instruction::Store: {
+      // Weak update, the stored pointers are added to what the location
+      // may already hold
       auto val = instr->getOperand(0);
-      auto ptr = instr->getOperand(1);
-      if (map.find(val) != map.end() && map.find(ptr) != map.end()) {
-        auto copy = map[ptr];
-        // The following loop might alter map[ptr], a temporary fix
-        for (auto &y : copy) {
-          input.add_ptr_alias(val, y);
+      if (!val->getType()->isPointerTy()) {
+        break;
+      }
+      auto addresses = LocationSet();
+      output.addPointees(instr->getOperand(1), addresses);
+      for (auto address : addresses) {
+        auto &locs = output.memory[address];
+        changed |= output.addPointees(val, locs);
+        if (locs.empty()) {
+          output.memory.erase(address);
         }
       }
       break;
     }
     case Instruction::Select: {
-      input.add_ptr_alias(instr->getOperand(1), instr);
-      input.add_ptr_alias(instr->getOperand(2), instr);
+      changed |= output.addPtrAlias(instr->getOperand(1), instr);
+      changed |= output.addPtrAlias(instr->getOperand(2), instr);
       break;
     }
     case Instruction::PHI: {
       for (auto &op : instr->operands()) {
-        input.add_ptr_alias(op, instr);
+        changed |= output.addPtrAlias(op, instr);
       }
       break;
     }
     default:
-      errs() << instr->getOpcodeName() << " ignored!"
-             << "\n";
+      // Reported once by `printIgnored`
+      break;
+    }
+
+    return changed;
+  }
+
+  /// Whether `transferInPlace` models the effect of `instr` on pointers
+  static auto isModeled(const Instruction &instr) -> bool {
+    switch (instr.getOpcode()) {
+    case Instruction::Alloca:
+    case Instruction::BitCast:
+    case Instruction::AddrSpaceCast:
+    case Instruction::GetElementPtr:
+    case Instruction::Load:
+    case Instruction::Store:
+    case Instruction::Select:
+    case Instruction::PHI:
+      return true;
+    default:
+      return false;
     }
+  }
 
-    return input;
+  /// Print the instructions of `F` the analysis ignores, once each and
+  /// independently of the solver mode, which replays the transfer function
+  /// a different number of times
+  static auto printIgnored(Function &F, raw_ostream &OS) -> void {
+    for (auto &instr : instructions(F)) {
+      if (!isModeled(instr)) {
+        OS << instr.getOpcodeName() << " ignored!"
+           << "\n";
+      }
+    }
   }
 };
 
 namespace {
 struct ReachingDefinitionPass : public PassInfoMixin<ReachingDefinitionPass> {
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-    // Instantiate reaching definition analysis with 'top' value of lattice
-    auto analysis = MayPointToAnalysis({}, F);
-
-    analysis.run();
-    analysis.print();
+  ReachingDefinitionPass(const PassParams &params)
+      : mode(parseSolverMode(params)), stats(params.count("stats")),
+        quiet(params.count("quiet")),
+        cache(makeAnalysisCache(params, ARGUMENT_NAME)) {
+    // Points-to sets are not a bit-vector lattice with gen / kill sets
+    if (mode == SolverMode::Sparse) {
+      report_fatal_error(Twine(ARGUMENT_NAME) +
+                         ": the sparse solver needs a bit-vector lattice");
+    }
+  }
 
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+    // Instruction graph shared with other analyses of the same function
+    analyze(F, FAM.getResult<InstrGraphAnalysis>(F), errs());
     return PreservedAnalyses::all();
   }
+
+  /// Analyze one function and print results to `OS`.
+  /// Also called concurrently by `ParallelAnalysisPass`.
+  auto analyze(Function &F, const InstrGraph &graph, raw_ostream &OS) const
+      -> void {
+    // Instantiate may point to analysis with 'top' value of lattice, whose
+    // locations are numbered as they are reached
+    auto locations = LocationTable(F);
+    auto analysis = MayPointToAnalysis(PtrInfo(&locations), graph, mode);
+    analysis.setOutput(OS);
+    if (stats) {
+      analysis.enableStats();
+    }
+
+    auto status = std::string();
+    if (cache) {
+      // Points-to sets are saved as indices of the values they relate
+      auto universe = ValueUniverse::operands(F);
+      status = cache->solve(analysis, F, universe);
+    } else {
+      analysis.run();
+    }
+    if (!quiet) {
+      MayPointToAnalysis::printIgnored(F, OS);
+      analysis.print();
+    }
+    if (cache) {
+      OS << "Cache: " << status << "\n";
+    }
+    if (stats) {
+      analysis.printStats();
+    }
+  }
+
+  SolverMode mode;
+  bool stats;
+  /// Solve without printing the facts, e.g. for benchmarks
+  bool quiet;
+  std::shared_ptr<AnalysisCache> cache;
 };
 } // namespace
 
@@ -141,11 +706,25 @@ extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
 llvmGetPassPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, PASS_NAME, PASS_VERSION,
           [](PassBuilder &PB) {
+            PB.registerAnalysisRegistrationCallback(registerInstrGraphAnalysis);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == ARGUMENT_NAME) {
-                    FPM.addPass(ReachingDefinitionPass());
+                  if (auto params = parsePassParams(Name, ARGUMENT_NAME)) {
+                    FPM.addPass(ReachingDefinitionPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && params->count("parallel")) {
+                    // Analyze all functions of the module concurrently
+                    MPM.addPass(ParallelAnalysisPass(
+                        ReachingDefinitionPass(*params), *params));
                     return true;
                   } else {
                     return false;
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "HelperFunctions.h"
+#include "InstrGraph.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/// Module pass running a per-function analysis pass on every function of the
+/// module concurrently.
+///
+/// `PassT` must provide `analyze(Function &, const InstrGraph &, raw_ostream &)
+/// const`, which is also what its serial `run` method calls. Each function
+/// gets its own instruction graph (the function analysis manager is not
+/// thread safe) and its own output buffer. Buffers are written to stderr in
+/// module order as soon as all preceding functions are done, so the output
+/// is byte-identical to running the function pass serially.
+template <class PassT>
+struct ParallelAnalysisPass
+    : public PassInfoMixin<ParallelAnalysisPass<PassT>> {
+  /// Number of worker threads is given by the `parallel=N` pass parameter,
+  /// `parallel` alone uses every hardware thread
+  ParallelAnalysisPass(PassT pass, const PassParams &params)
+      : pass(std::move(pass)),
+        threads(parsePositiveParam(params, "parallel", 0)) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    // Same functions, same order as the function pass manager
+    std::vector<Function *> functions;
+    for (auto &F : M) {
+      if (!F.isDeclaration()) {
+        functions.push_back(&F);
+      }
+    }
+
+    // Tasks are queued one per function and picked up by whichever worker
+    // is idle, so a few large functions do not hold back the rest
+    auto outputs = std::vector<std::string>(functions.size());
+    auto done = std::vector<std::shared_future<void>>();
+    auto pool = ThreadPool(hardware_concurrency(threads));
+    for (size_t i = 0; i < functions.size(); i++) {
+      done.push_back(pool.async([this, &functions, &outputs, i] {
+        auto OS = raw_string_ostream(outputs[i]);
+        auto graph = InstrGraph(*functions[i]);
+        pass.analyze(*functions[i], graph, OS);
+      }));
+    }
+
+    for (size_t i = 0; i < functions.size(); i++) {
+      done[i].wait();
+      errs() << outputs[i];
+      outputs[i] = std::string();
+    }
+
+    return PreservedAnalyses::all();
+  }
+
+  PassT pass;
+  unsigned threads;
+};
@@ -1,4 +1,6 @@
+#include "AnalysisCache.h"
 #include "DFAFramework.h"
+#include "ParallelDriver.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 
@@ -8,33 +10,30 @@ static auto PASS_NAME = "ReachingDefinitionPass";
 static auto PASS_VERSION = "v0.1";
 static auto ARGUMENT_NAME = "reaching";
 
-class DefInfo {
+/// Set of definitions, stored as a bit vector over the instructions of the
+/// function
+class DefInfo : public BitVectorInfo<DefInfo> {
 public:
   /// Interestingly, while the default constructor is never explicitly called,
   /// removing it will result in a compile error
   DefInfo() {}
-  DefInfo(std::set<Instruction *> set) : defs(set) {}
+  DefInfo(const ValueUniverse *universe) : BitVectorInfo(universe) {}
 
   /// Print definition set for a given statement
-  /// Called by `print` method of class `DataFlowAnalysis`
-  auto print(Bimap<Instruction *, unsigned> &instrMap) -> void {
-    for (auto &def : defs) {
-      errs() << instrMap[def] << " ";
-    }
-  }
-
-  /// Return true if definition sets have the same definitions
-  auto operator==(const DefInfo &other) const -> bool {
-    return defs == other.defs;
+  /// Called by `print` method of class `DataFlowAnalysis`.
+  /// The universe numbers instructions like the printer does, so the
+  /// printed number of a definition is its index + 1, no lookup needed.
+  auto print(raw_ostream &OS, const Bimap<Instruction *, unsigned> &) -> void {
+    forEachIndex([&](unsigned index) { OS << index + 1 << " "; });
   }
 
   /// Meet operator for reaching definition analysis is simply union for
   /// definition set
   auto operator^(const DefInfo &other) const -> DefInfo {
-    return DefInfo(set::union2(defs, other.defs));
+    return *this | other;
   }
 
-  std::set<Instruction *> defs;
+  auto operator^=(const DefInfo &other) -> DefInfo & { return *this |= other; }
 };
 
 class ReachingDefinitionAnalysis
@@ -49,23 +48,68 @@ public:
   virtual auto transferFunction(Instruction *instr, DefInfo input) -> DefInfo {
     // Input is passed in by value, won't change the `in` set
     if (!noRetValue(*instr)) {
-      input.defs.insert(instr);
+      input.insert(instr);
     }
     return input;
   }
+
+  /// Each definition is generated by its own instruction and never killed
+  virtual auto genKill(Instruction *instr, SmallVectorImpl<unsigned> &gen,
+                       SmallVectorImpl<unsigned> &) -> void {
+    if (!noRetValue(*instr)) {
+      gen.push_back(getTop().universe->indexOf(instr));
+    }
+  }
 };
 
 namespace {
 struct ReachingDefinitionPass : public PassInfoMixin<ReachingDefinitionPass> {
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-    // Instantiate reaching definition analysis with 'top' value of lattice
-    auto analysis = ReachingDefinitionAnalysis({}, F);
-
-    analysis.run();
-    analysis.print();
+  ReachingDefinitionPass(const PassParams &params)
+      : mode(parseSolverMode(params)), stats(params.count("stats")),
+        quiet(params.count("quiet")),
+        cache(makeAnalysisCache(params, ARGUMENT_NAME)) {}
 
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+    // Instruction graph shared with other analyses of the same function
+    analyze(F, FAM.getResult<InstrGraphAnalysis>(F), errs());
     return PreservedAnalyses::all();
   }
+
+  /// Analyze one function and print results to `OS`.
+  /// Also called concurrently by `ParallelAnalysisPass`.
+  auto analyze(Function &F, const InstrGraph &graph, raw_ostream &OS) const
+      -> void {
+    // Definitions are numbered in the same order as they are printed
+    auto universe = ValueUniverse::instructions(F);
+    // Instantiate reaching definition analysis with 'top' value of lattice
+    auto analysis = ReachingDefinitionAnalysis(DefInfo(&universe), graph, mode);
+    analysis.setOutput(OS);
+    if (stats) {
+      analysis.enableStats();
+    }
+
+    auto status = std::string();
+    if (cache) {
+      status = cache->solve(analysis, F, universe);
+    } else {
+      analysis.run();
+    }
+    if (!quiet) {
+      analysis.print();
+    }
+    if (cache) {
+      OS << "Cache: " << status << "\n";
+    }
+    if (stats) {
+      analysis.printStats();
+    }
+  }
+
+  SolverMode mode;
+  bool stats;
+  /// Solve without printing the facts, e.g. for benchmarks
+  bool quiet;
+  std::shared_ptr<AnalysisCache> cache;
 };
 } // namespace
 
@@ -73,11 +117,25 @@ extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
 llvmGetPassPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, PASS_NAME, PASS_VERSION,
           [](PassBuilder &PB) {
+            PB.registerAnalysisRegistrationCallback(registerInstrGraphAnalysis);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == ARGUMENT_NAME) {
-                    FPM.addPass(ReachingDefinitionPass());
+                  if (auto params = parsePassParams(Name, ARGUMENT_NAME)) {
+                    FPM.addPass(ReachingDefinitionPass(*params));
+                    return true;
+                  } else {
+                    return false;
+                  }
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  auto params = parsePassParams(Name, ARGUMENT_NAME);
+                  if (params && params->count("parallel")) {
+                    // Analyze all functions of the module concurrently
+                    MPM.addPass(ParallelAnalysisPass(
+                        ReachingDefinitionPass(*params), *params));
                     return true;
                   } else {
                     return false;
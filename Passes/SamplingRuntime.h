@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/// Helpers for the slow paths of sampling profilers (`cdi<sample=N>`,
+/// `bb<sample=N>`). Instrumented code decrements a thread-local countdown
+/// of its module and calls into the runtime once it expires. The runtime
+/// records one sample and returns the next countdown.
+
+/// Distance to the next sample, drawn uniformly from `[1, 2 * period - 1]`:
+/// on average every `period`-th event is sampled, without aliasing with
+/// loops whose trip count divides the period
+static inline auto nextCountdown(uint64_t period) -> int64_t {
+  if (period <= 1) {
+    return 1;
+  }
+  // xorshift64, seeded differently per thread
+  thread_local uint64_t state =
+      reinterpret_cast<uintptr_t>(&state) | 0x9E3779B97F4A7C15;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return 1 + state % (2 * period - 1);
+}
+
+/// Variance of the estimate `period * sum(c)`, where `c` is what each
+/// sample recorded and `sumSquares` is `sum(c * c)`. Each event is treated
+/// as sampled independently with probability `1 / period`, which
+/// overestimates the error of the more regular countdown. Variances of
+/// estimates with different periods add up.
+static inline auto sampleVariance(uint64_t period, uint64_t sumSquares)
+    -> uint64_t {
+  return period * (period - 1) * sumSquares;
+}
+
+/// Half-width of the ~95% confidence interval of an estimate of the given
+/// variance
+static inline auto confidenceBound(uint64_t variance) -> double {
+  return 1.96 * std::sqrt(double(variance));
+}
+
+/// Half-width of the ~95% confidence interval of the estimate
+/// `period * sum(c)`, see `sampleVariance`
+static inline auto sampleErrorBound(uint64_t period, uint64_t sumSquares)
+    -> double {
+  return 1.96 * std::sqrt(double(period) * double(period - 1) *
+                          double(sumSquares));
+}
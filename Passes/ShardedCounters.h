@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/// Process-wide array of `N` counters for profiling runtimes, safe to update
+/// from any number of threads without locks or contended cache lines.
+///
+/// Every thread adds to its own shard, so an update is a plain load and
+/// store on memory no other thread writes. Shards are pushed on a lock-free
+/// list the first time a thread counts anything, and handed over to the
+/// next new thread once their owner exits, so short-lived threads do not
+/// accumulate shards. Counts of exited threads stay in the shard.
+///
+/// `drain` adds up all shards and reports what was counted since the
+/// previous `drain`. Counts are exact as long as the counting threads are
+/// done (joined) or quiescent when draining; updates racing with `drain`
+/// are reported by the next one.
+///
+/// `Tag` keeps counters of different runtimes linked into one program
+/// apart. Everything is static and constant initialized, so counting works
+/// from global constructors too.
+template <class Tag, size_t N> class ShardedCounters {
+public:
+  /// Add `count` to counter `index` of the calling thread
+  static auto add(size_t index, uint64_t count) -> void {
+    auto &counter = localShard()->counts[index];
+    // Single writer, no read-modify-write needed
+    counter.store(counter.load(std::memory_order_relaxed) + count,
+                  std::memory_order_relaxed);
+  }
+
+  /// Call `f(index, count)` for every counter that grew since the last call,
+  /// in increasing index order
+  template <typename F> static auto drain(F f) -> void {
+    auto lock = std::lock_guard<std::mutex>(drainMutex);
+    uint64_t totals[N] = {};
+    for (auto shard = shards.load(std::memory_order_acquire); shard != nullptr;
+         shard = shard->next) {
+      for (size_t i = 0; i < N; i++) {
+        auto count = shard->counts[i].load(std::memory_order_relaxed);
+        totals[i] += count - shard->drained[i];
+        shard->drained[i] = count;
+      }
+    }
+    for (size_t i = 0; i < N; i++) {
+      if (totals[i] != 0) {
+        f(i, totals[i]);
+      }
+    }
+  }
+
+private:
+  struct Shard {
+    std::atomic<uint64_t> counts[N] = {};
+    /// Part of `counts` already reported, only accessed by `drain`
+    uint64_t drained[N] = {};
+    /// Whether a live thread owns the shard
+    std::atomic<bool> owned = true;
+    /// Next shard in the list, fixed once the shard is published
+    Shard *next = nullptr;
+  };
+
+  /// Releases the shard of a thread when it exits
+  struct Owner {
+    Shard *shard = nullptr;
+
+    ~Owner() {
+      if (shard != nullptr) {
+        shard->owned.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  static auto localShard() -> Shard * {
+    auto &owner = localOwner;
+    if (owner.shard == nullptr) {
+      owner.shard = acquireShard();
+    }
+    return owner.shard;
+  }
+
+  /// Reuse the shard of an exited thread, or publish a new one
+  static auto acquireShard() -> Shard * {
+    for (auto shard = shards.load(std::memory_order_acquire); shard != nullptr;
+         shard = shard->next) {
+      auto owned = false;
+      if (!shard->owned.load(std::memory_order_relaxed) &&
+          shard->owned.compare_exchange_strong(owned, true,
+                                               std::memory_order_acquire)) {
+        return shard;
+      }
+    }
+
+    // Shards are never freed, they may be drained after their thread exits
+    auto shard = new Shard();
+    shard->next = shards.load(std::memory_order_relaxed);
+    while (!shards.compare_exchange_weak(shard->next, shard,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+    return shard;
+  }
+
+  inline static std::atomic<Shard *> shards = nullptr;
+  inline static std::mutex drainMutex;
+  inline static thread_local Owner localOwner;
+};
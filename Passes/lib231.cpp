@@ -2,14 +2,19 @@
 #include <map>
 #include <string>
 
+#include "ShardedCounters.h"
 #include "llvm/IR/Instruction.h"
 #include <stdint.h>
 #include <stdlib.h>
 using namespace llvm;
 using namespace std;
 
-std::map<string, unsigned> instr_map;
-int branch_count[2];
+// Per-thread counters, so that multithreaded programs neither race nor
+// serialize on a lock. Instructions are counted by opcode and named when
+// printing.
+using instr_counts =
+    ShardedCounters<struct InstrInfoTag, Instruction::OtherOpsEnd>;
+using branch_count = ShardedCounters<struct BranchInfoTag, 2>;
 
 // clang++ /tmp/lib231.ll /tmp/hello-cdi.ll `llvm-config --system-libs
 // --cppflags --ldflags --libs core` -o /tmp/cdi_hello
@@ -20,19 +25,8 @@ int branch_count[2];
 // values: the array of the counts of the instructions
 extern "C" __attribute__((visibility("default"))) void
 updateInstrInfo(unsigned num, uint32_t *keys, uint32_t *values) {
-  int i;
-  uint32_t key;
-  uint32_t value;
-  string keyString;
-
-  for (i = 0; i < num; i++) {
-    keyString = Instruction::getOpcodeName(keys[i]);
-    value = values[i];
-    if (instr_map.count(keyString) == 0)
-      instr_map.insert(std::pair<string, uint32_t>(keyString, value));
-    else
-      instr_map[keyString] = instr_map[keyString] + value;
-  }
+  for (unsigned i = 0; i < num; i++)
+    instr_counts::add(keys[i], values[i]);
 
   return;
 }
@@ -44,8 +38,8 @@ extern "C" __attribute__((visibility("default"))) void
 updateBranchInfo(bool taken) {
 
   if (taken)
-    branch_count[0]++;
-  branch_count[1]++;
+    branch_count::add(0, 1);
+  branch_count::add(1, 1);
 
   return;
 }
@@ -53,11 +47,14 @@ updateBranchInfo(bool taken) {
 // For section 2
 extern "C" __attribute__((visibility("default"))) void printOutInstrInfo() {
 
-  for (std::map<string, uint32_t>::iterator it = instr_map.begin();
-       it != instr_map.end(); ++it)
-    std::cerr << it->first << '\t' << it->second << '\n';
+  // Same order as the former map keyed by opcode name
+  std::map<string, uint64_t> instr_map;
+  instr_counts::drain([&](size_t opcode, uint64_t count) {
+    instr_map[Instruction::getOpcodeName(opcode)] += count;
+  });
 
-  instr_map.clear();
+  for (auto it = instr_map.begin(); it != instr_map.end(); ++it)
+    std::cerr << it->first << '\t' << it->second << '\n';
 
   return;
 }
@@ -65,11 +62,11 @@ extern "C" __attribute__((visibility("default"))) void printOutInstrInfo() {
 // For section 3
 extern "C" __attribute__((visibility("default"))) void printOutBranchInfo() {
 
-  std::cerr << "taken\t" << branch_count[0] << '\n';
-  std::cerr << "total\t" << branch_count[1] << '\n';
+  uint64_t counts[2] = {};
+  branch_count::drain([&](size_t i, uint64_t count) { counts[i] = count; });
 
-  branch_count[0] = 0;
-  branch_count[1] = 0;
+  std::cerr << "taken\t" << counts[0] << '\n';
+  std::cerr << "total\t" << counts[1] << '\n';
 
   return;
 }
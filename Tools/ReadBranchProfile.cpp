@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../Passes/BranchProfile.h"
+#include "../Passes/SamplingRuntime.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/// Branch site as read from a profile
+struct Site {
+  StringRef function;
+  StringRef block;
+  uint32_t line;
+  /// Samples if `period` is not 1
+  uint64_t taken;
+  uint64_t total;
+  /// Sampling period of the module
+  uint64_t period;
+};
+
+/// Cursor over the profile, every read fails once the data is exhausted
+class ProfileReader {
+public:
+  ProfileReader(StringRef data) : data(data) {}
+
+  auto readU32(uint32_t &value) -> bool {
+    if (data.size() < 4) {
+      return false;
+    }
+    value = support::endian::read32le(data.data());
+    data = data.drop_front(4);
+    return true;
+  }
+
+  auto readU64(uint64_t &value) -> bool {
+    if (data.size() < 8) {
+      return false;
+    }
+    value = support::endian::read64le(data.data());
+    data = data.drop_front(8);
+    return true;
+  }
+
+  auto readBytes(size_t size, StringRef &bytes) -> bool {
+    if (data.size() < size) {
+      return false;
+    }
+    bytes = data.take_front(size);
+    data = data.drop_front(size);
+    return true;
+  }
+
+  auto atEnd() const -> bool { return data.empty(); }
+
+  /// Bytes left to read
+  auto remaining() const -> size_t { return data.size(); }
+
+private:
+  StringRef data;
+};
+
+/// Read one module record, see `BranchProfile.h`
+static auto readModule(ProfileReader &reader, std::vector<Site> &sites)
+    -> bool {
+  uint32_t numSites, descriptionSize;
+  uint64_t period;
+  if (!reader.readU32(numSites) || !reader.readU32(descriptionSize) ||
+      !reader.readU64(period)) {
+    return false;
+  }
+
+  // A line and a (taken, total) pair per site, checked before allocating
+  if (numSites > reader.remaining() / (4 + 16)) {
+    return false;
+  }
+
+  auto first = sites.size();
+  sites.resize(first + numSites);
+  for (uint32_t i = 0; i < numSites; i++) {
+    if (!reader.readU32(sites[first + i].line)) {
+      return false;
+    }
+    sites[first + i].period = std::max<uint64_t>(period, 1);
+  }
+  for (uint32_t i = 0; i < numSites; i++) {
+    if (!reader.readU64(sites[first + i].taken) ||
+        !reader.readU64(sites[first + i].total)) {
+      return false;
+    }
+  }
+
+  StringRef descriptions;
+  if (!reader.readBytes(descriptionSize, descriptions)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numSites; i++) {
+    std::tie(sites[first + i].function, descriptions) =
+        descriptions.split('\0');
+    std::tie(sites[first + i].block, descriptions) = descriptions.split('\0');
+  }
+  return true;
+}
+
+/// Print the sites of a branch profile, most executed first:
+/// function, block, line, taken, total and percentage taken. Sampled counts
+/// are scaled up, and followed by the half-width of their ~95% confidence
+/// interval if the profile has any.
+auto main(int argc, char **argv) -> int {
+  auto path = argc > 1 ? argv[1] : BranchProfile::DEFAULT_PATH;
+  auto buffer = MemoryBuffer::getFile(path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    errs() << path << ": " << buffer.getError().message() << "\n";
+    return 1;
+  }
+
+  auto reader = ProfileReader((*buffer)->getBuffer());
+  uint32_t magic, version;
+  if (!reader.readU32(magic) || magic != BranchProfile::MAGIC ||
+      !reader.readU32(version) || version != BranchProfile::VERSION) {
+    errs() << path << ": not a branch profile of version "
+           << BranchProfile::VERSION << "\n";
+    return 1;
+  }
+
+  auto sites = std::vector<Site>();
+  while (!reader.atEnd()) {
+    if (!readModule(reader, sites)) {
+      errs() << path << ": truncated branch profile\n";
+      return 1;
+    }
+  }
+
+  std::stable_sort(sites.begin(), sites.end(), [](auto &a, auto &b) {
+    return a.period * a.total > b.period * b.total;
+  });
+  auto sampled = std::any_of(sites.begin(), sites.end(),
+                             [](auto &site) { return site.period != 1; });
+  outs() << "function\tblock\tline\ttaken\ttotal\tbias";
+  if (sampled) {
+    outs() << "\ttaken+-\ttotal+-";
+  }
+  outs() << "\n";
+  for (auto &site : sites) {
+    outs() << site.function << "\t" << site.block << "\t" << site.line << "\t"
+           << site.period * site.taken << "\t" << site.period * site.total
+           << "\t";
+    if (site.total != 0) {
+      outs() << format("%.1f%%", 100.0 * site.taken / site.total);
+    }
+    // Each sample counts 0 or 1, so the sum of squares is the sum of samples
+    if (site.period != 1) {
+      outs() << "\t" << std::llround(sampleErrorBound(site.period, site.taken))
+             << "\t" << std::llround(sampleErrorBound(site.period, site.total));
+    } else if (sampled) {
+      outs() << "\t\t";
+    }
+    outs() << "\n";
+  }
+  return 0;
+}